@@ -37,22 +37,30 @@
 
 #include "iss/arch/traits.h"
 #include "iss/arch_if.h"
+#include "iss/code_tracking.h"
 #include "iss/instrumentation_if.h"
 #include "iss/log_categories.h"
+#include "iss/memory_watch.h"
+#include "iss/statistics.h"
 #include "iss/vm_if.h"
 #ifndef FMT_HEADER_ONLY
 #define FMT_HEADER_ONLY
 #endif
 #include <fmt/format.h>
+#include <algorithm>
 #include <array>
+#include <bitset>
 #include <elfio/elfio.hpp>
 #include <iomanip>
+#include <limits>
+#include <mutex>
 #include <sstream>
 #include <type_traits>
 #include <unordered_map>
 #include <util/bit_field.h>
 #include <util/ities.h>
 #include <util/sparse_array.h>
+#include <vector>
 
 #if defined(__GNUC__)
 #define likely(x) __builtin_expect(!!(x), 1)
@@ -268,7 +276,9 @@ public:
 };
 }
 
-template <typename BASE> class riscv_hart_msu_vp : public BASE {
+template <typename BASE>
+class riscv_hart_msu_vp : public BASE, public iss::statistics_if, public iss::code_tracking_if,
+                          public iss::memory_watch_if {
 public:
     using super = BASE;
     using this_class = riscv_hart_msu_vp<BASE>;
@@ -489,6 +499,76 @@ public:
     };
 
     iss::instrumentation_if *get_instrumentation_if() override { return &instr_if; }
+
+    void collect_statistics(iss::statistics &stats) const override {
+        stats += hart_stats;
+        stats.instructions += this->reg.icount;
+    }
+
+    void set_code_invalidation_handler(iss::code_tracking_if::invalidation_fn handler) override {
+        code_invalidation_handler = handler;
+        code_regions.clear();
+        code_page_count = 0;
+        last_code_region = std::numeric_limits<uint64_t>::max();
+        last_code_bits = nullptr;
+        pending_code_invalidations.clear();
+    }
+
+    iss::code_tracking_if::invalidation_fn const &get_code_invalidation_handler() const {
+        return code_invalidation_handler;
+    }
+
+    void request_code_invalidation(uint64_t start, uint64_t end) override {
+        std::lock_guard<std::mutex> lock(requested_code_invalidations_mtx);
+        requested_code_invalidations.emplace_back(start, end);
+        this->async_event = true;
+    }
+    /**
+     * drop the reservations of LR instructions overlapping a store of another hart
+     *
+     * @param addr the physical address of the store
+     * @param length the number of bytes stored
+     * @return true if the hart still holds a reservation
+     */
+    bool break_reservation(uint64_t addr, unsigned length) {
+        for (auto it = atomic_reservation.begin(); it != atomic_reservation.end();)
+            if (it->first < addr + length && it->first + sizeof(reg_t) > addr)
+                it = atomic_reservation.erase(it);
+            else
+                ++it;
+        return !atomic_reservation.empty();
+    }
+    /**
+     * reservations are kept by physical address as stores of other harts are matched against them
+     *
+     * @param type the address type of the LR/SC access
+     * @param addr the address of the LR/SC access
+     * @return the physical address the access translates to
+     */
+    uint64_t reservation_addr(address_type type, uint64_t addr) {
+        if (type == iss::address_type::PHYSICAL) return addr;
+        return BASE::v2p(iss::addr_t{iss::access_type::READ, type, traits<BASE>::MEM, addr}).val;
+    }
+
+    void add_watch(uint64_t start, uint64_t length, bool on_read, bool on_write) override {
+        auto end = start + std::max<uint64_t>(length, 1);
+        watches.push_back({start, end, on_read, on_write});
+        for (auto page = start >> PGSHIFT; page <= (end - 1) >> PGSHIFT; ++page) watch_pages[page]++;
+    }
+
+    bool remove_watch(uint64_t start, uint64_t length, bool on_read, bool on_write) override {
+        auto end = start + std::max<uint64_t>(length, 1);
+        auto it = std::find_if(watches.begin(), watches.end(), [=](const watch_range &w) {
+            return w.start == start && w.end == end && w.on_read == on_read && w.on_write == on_write;
+        });
+        if (it == watches.end()) return false;
+        watches.erase(it);
+        for (auto page = start >> PGSHIFT; page <= (end - 1) >> PGSHIFT; ++page)
+            if (--watch_pages[page] == 0) watch_pages.erase(page);
+        return true;
+    }
+
+    void set_watch_handler(iss::memory_watch_if::watch_fn handler) override { watch_handler = handler; }
  
 protected:
     struct riscv_instrumentation_if : public iss::instrumentation_if {
@@ -520,15 +600,65 @@ protected:
 
     virtual iss::status read_csr(unsigned addr, reg_t &val);
     virtual iss::status write_csr(unsigned addr, reg_t val);
+    /**
+     * get the cycle (icount + cycle_offset) at which the next event able to wake up the hart (e.g. a timer
+     * interrupt) occurs. It is used to skip idle periods in WFI and in loops polling the time
+     *
+     * @return the cycle of the next event or the max. value if there is none
+     */
+    virtual uint64_t next_event_cycle() {
+        if ((csr[mip] & (1ULL << 7)) != 0 || mtimecmp > std::numeric_limits<uint64_t>::max() / rtc_divider)
+            return std::numeric_limits<uint64_t>::max();
+        return mtimecmp * rtc_divider;
+    }
+    /**
+     * raise the timer interrupt once mtime reaches mtimecmp and schedule the next event check
+     */
+    void process_events() override;
+    /**
+     * process the events from within an instruction, pending code invalidations are kept until the block
+     * boundary as the executing block may be affected
+     */
+    void reschedule_events() {
+        in_instruction = true;
+        process_events();
+        in_instruction = false;
+    }
+    bool in_instruction = false;
+    /**
+     * advance the simulated time to the given cycle without executing instructions
+     *
+     * @param cycle the cycle to advance to, cycles in the past are ignored
+     */
+    void fast_forward(uint64_t cycle) {
+        auto now = this->reg.icount + cycle_offset;
+        if (cycle > now && cycle != std::numeric_limits<uint64_t>::max()) cycle_offset += cycle - now;
+        reschedule_events();
+    }
+
+    void skip_time_polling();
+    /**
+     * a store or a trap may change the state the polling loop waits for, its next time read starts a new loop
+     */
+    void end_time_polling() { time_poll_pc = std::numeric_limits<uint64_t>::max(); }
+
+    // cycles per tick of the real time clock (mtime)
+    static constexpr unsigned rtc_divider = 100000000 / 32768 - 1; //-> ~3052;
+    // max. number of instructions between two reads of the time to be considered a polling loop
+    static constexpr unsigned max_poll_loop_len = 64;
 
     hart_state<reg_t> state;
     uint64_t cycle_offset;
+    uint64_t time_poll_pc = std::numeric_limits<uint64_t>::max();
+    uint64_t time_poll_icount = 0;
+    uint64_t mtimecmp = std::numeric_limits<uint64_t>::max();
     reg_t fault_data;
     std::array<vm_info, 2> vm;
     uint64_t tohost = tohost_dflt;
     uint64_t fromhost = fromhost_dflt;
     unsigned to_host_wr_cnt = 0;
     riscv_instrumentation_if instr_if;
+    iss::statistics hart_stats;
 
     using mem_type = util::sparse_array<uint8_t, 1ULL << 32>;
     using csr_type = util::sparse_array<typename traits<BASE>::reg_t, 1ULL << 12, 12>;
@@ -539,8 +669,112 @@ protected:
     std::stringstream uart_buf;
     std::unordered_map<reg_t, uint64_t> ptw;
     std::unordered_map<uint64_t, uint8_t> atomic_reservation;
+    /**
+     * called before the first and after the last memory access of an AMO or LR/SC, a hart sharing the memory
+     * with others serializes the atomic accesses and the reservations here
+     */
+    virtual void enter_atomic_section() {}
+    virtual void leave_atomic_section() {}
+    // the atomic section ends with the last memory access of the instruction or a trap raised by it
+    void end_atomic_section() {
+        if (in_atomic_section) {
+            in_atomic_section = false;
+            leave_atomic_section();
+        }
+    }
+    bool in_atomic_section = false;
     std::unordered_map<unsigned, rd_csr_f> csr_rd_cb;
     std::unordered_map<unsigned, wr_csr_f> csr_wr_cb;
+    // physical pages instructions have been fetched from since they have been modified the last time. They are
+    // kept as a bitmap per region of 128MiB, the region looked up last is cached as stores tend to stay within it
+    static constexpr unsigned CODE_REGION_SHIFT = 15;
+    static constexpr uint64_t CODE_REGION_MASK = (1U << CODE_REGION_SHIFT) - 1;
+    using code_page_bits = std::bitset<1U << CODE_REGION_SHIFT>;
+    std::unordered_map<uint64_t, code_page_bits> code_regions;
+    uint64_t code_page_count = 0;
+    uint64_t last_code_region = std::numeric_limits<uint64_t>::max();
+    code_page_bits *last_code_bits = nullptr;
+    iss::code_tracking_if::invalidation_fn code_invalidation_handler;
+    // modified code pages, the translated code is dropped at the next block boundary as the modifying
+    // block may be translated from the page itself
+    std::vector<std::pair<uint64_t, uint64_t>> pending_code_invalidations;
+    // invalidations requested by other threads, e.g. by the debugger
+    std::mutex requested_code_invalidations_mtx;
+    std::vector<std::pair<uint64_t, uint64_t>> requested_code_invalidations;
+
+    inline code_page_bits *get_code_region(uint64_t region, bool create) {
+        if (region != last_code_region || (create && last_code_bits == nullptr)) {
+            auto it = code_regions.find(region);
+            if (it == code_regions.end() && create) it = code_regions.emplace(region, code_page_bits{}).first;
+            last_code_region = region;
+            last_code_bits = it == code_regions.end() ? nullptr : &it->second;
+        }
+        return last_code_bits;
+    }
+
+    inline void track_code_fetch(uint64_t paddr) {
+        if (!code_invalidation_handler) return;
+        auto page = paddr >> PGSHIFT;
+        auto &bits = *get_code_region(page >> CODE_REGION_SHIFT, true);
+        auto idx = page & CODE_REGION_MASK;
+        if (!bits[idx]) {
+            bits.set(idx);
+            ++code_page_count;
+        }
+    }
+
+    inline void track_code_write(uint64_t paddr, unsigned length) {
+        if (likely(code_page_count == 0)) return;
+        for (auto page = paddr >> PGSHIFT; page <= (paddr + length - 1) >> PGSHIFT; ++page) {
+            auto *bits = get_code_region(page >> CODE_REGION_SHIFT, false);
+            if (bits != nullptr && (*bits)[page & CODE_REGION_MASK]) untrack_code_page(*bits, page);
+        }
+    }
+
+    void untrack_code_page(code_page_bits &bits, uint64_t page) {
+        bits.reset(page & CODE_REGION_MASK);
+        --code_page_count;
+        pending_code_invalidations.emplace_back(page << PGSHIFT, (page + 1) << PGSHIFT);
+        this->next_event_icount = 0; // have process_events called at the end of the current block
+    }
+
+    /**
+     * drop the code translated from the tracked pages overlapping the physical address range [start, end]
+     * at the next block boundary
+     *
+     * @param start the first address of the range
+     * @param end the last address of the range
+     */
+    void invalidate_code_pages(uint64_t start, uint64_t end) {
+        if (code_page_count == 0) return;
+        for (auto &region : code_regions) {
+            auto first = std::max(start >> PGSHIFT, region.first << CODE_REGION_SHIFT);
+            auto last = std::min(end >> PGSHIFT, ((region.first + 1) << CODE_REGION_SHIFT) - 1);
+            for (auto page = first; page <= last; ++page)
+                if (region.second[page & CODE_REGION_MASK]) untrack_code_page(region.second, page);
+        }
+    }
+
+    struct watch_range {
+        uint64_t start, end;
+        bool on_read, on_write;
+    };
+    std::vector<watch_range> watches;
+    // number of watched ranges per page, only accesses to these pages are compared against the ranges
+    std::unordered_map<uint64_t, unsigned> watch_pages;
+    iss::memory_watch_if::watch_fn watch_handler;
+
+    // the ranges come from the debugger, hence they are compared against the address as used by the program
+    inline void check_watch(uint64_t addr, unsigned length, bool is_write) {
+        if (likely(watch_pages.empty())) return;
+        if (watch_pages.count(addr >> PGSHIFT) == 0 && watch_pages.count((addr + length - 1) >> PGSHIFT) == 0)
+            return;
+        for (auto &w : watches)
+            if ((is_write ? w.on_write : w.on_read) && addr < w.end && addr + length > w.start) {
+                if (watch_handler) watch_handler(addr, is_write);
+                return;
+            }
+    }
 
 private:
     iss::status read_cycle(unsigned addr, reg_t &val);
@@ -685,10 +919,13 @@ iss::status riscv_hart_msu_vp<BASE>::read(const address_type type, const access_
                         return res;
                     }
                 }
-                auto res = type==iss::address_type::PHYSICAL?
-                        read_mem( BASE::v2p(phys_addr_t{access, space, addr}), length, data):
-                        read_mem( BASE::v2p(iss::addr_t{access, type, space, addr}), length, data);
+                auto paddr = type==iss::address_type::PHYSICAL?
+                        BASE::v2p(phys_addr_t{access, space, addr}):
+                        BASE::v2p(iss::addr_t{access, type, space, addr});
+                auto res = read_mem(paddr, length, data);
                 if (unlikely(res != iss::Ok)) this->reg.trap_state = (1 << 31) | (5 << 16); // issue trap 5 (load access fault
+                else if (access == iss::access_type::FETCH) track_code_fetch(paddr.val);
+                else if (!(access && iss::access_type::DEBUG)) check_watch(addr, length, false);
                 return res;
             } catch (trap_access &ta) {
                 this->reg.trap_state = (1 << 31) | ta.id;
@@ -715,12 +952,14 @@ iss::status riscv_hart_msu_vp<BASE>::read(const address_type type, const access_
             }
         } break;
         case traits<BASE>::RES: {
-            auto it = atomic_reservation.find(addr);
+            auto it = atomic_reservation.find(reservation_addr(type, addr));
             if (it != atomic_reservation.end() && it->second != 0) {
                 memset(data, 0xff, length);
-                atomic_reservation.erase(addr);
-            } else
+                atomic_reservation.erase(it);
+            } else {
                 memset(data, 0, length);
+                end_atomic_section(); // the SC fails and does not store
+            }
         } break;
         default:
             return iss::Err; // assert("Not supported");
@@ -779,11 +1018,18 @@ iss::status riscv_hart_msu_vp<BASE>::write(const address_type type, const access
                         return res;
                     }
                 }
-                auto res = type==iss::address_type::PHYSICAL?
-                        write_mem(phys_addr_t{access, space, addr}, length, data):
-                        write_mem(BASE::v2p(iss::addr_t{access, type, space, addr}), length, data);
+                auto paddr = type==iss::address_type::PHYSICAL?
+                        phys_addr_t{access, space, addr}:
+                        BASE::v2p(iss::addr_t{access, type, space, addr});
+                auto res = write_mem(paddr, length, data);
+                end_atomic_section();
+                end_time_polling();
                 if (unlikely(res != iss::Ok))
                     this->reg.trap_state = (1 << 31) | (5 << 16); // issue trap 7 (Store/AMO access fault)
+                else {
+                    track_code_write(paddr.val, length);
+                    if (!(access && iss::access_type::DEBUG)) check_watch(addr, length, true);
+                }
                 return res;
             } catch (trap_access &ta) {
                 this->reg.trap_state = (1 << 31) | ta.id;
@@ -829,6 +1075,12 @@ iss::status riscv_hart_msu_vp<BASE>::write(const address_type type, const access
         case traits<BASE>::FENCE: {
             if ((addr + length) > mem.size()) return iss::Err;
             switch (addr) {
+            case 4: // start of an AMO or LR/SC, issued by the VM ahead of its memory accesses
+                if (!in_atomic_section) {
+                    in_atomic_section = true;
+                    enter_atomic_section();
+                }
+                return iss::Ok;
             case 2:
             case 3: {
                 ptw.clear();
@@ -843,7 +1095,8 @@ iss::status riscv_hart_msu_vp<BASE>::write(const address_type type, const access
             }
         } break;
         case traits<BASE>::RES: {
-            atomic_reservation[addr] = data[0];
+            atomic_reservation[reservation_addr(type, addr)] = data[0];
+            end_atomic_section();
         } break;
         default:
             return iss::Err;
@@ -897,8 +1150,48 @@ template <typename BASE> iss::status riscv_hart_msu_vp<BASE>::read_cycle(unsigne
     return iss::Ok;
 }
 
+template <typename BASE> void riscv_hart_msu_vp<BASE>::process_events() {
+    if (!in_instruction) {
+        if (this->async_event.exchange(false)) {
+            std::lock_guard<std::mutex> lock(requested_code_invalidations_mtx);
+            pending_code_invalidations.insert(pending_code_invalidations.end(), requested_code_invalidations.begin(),
+                                              requested_code_invalidations.end());
+            requested_code_invalidations.clear();
+        }
+        if (code_invalidation_handler)
+            for (auto &range : pending_code_invalidations) code_invalidation_handler(range.first, range.second);
+        pending_code_invalidations.clear();
+    }
+    auto now = this->reg.icount + cycle_offset;
+    auto next = next_event_cycle();
+    if (now >= next) {
+        csr[mip] |= 1ULL << 7; // MTIP
+        check_interrupt();
+        next = next_event_cycle();
+    }
+    // the VM checks icount against the event at block boundaries
+    this->next_event_icount = next == std::numeric_limits<uint64_t>::max()
+                                  ? next
+                                  : next - std::min(next, cycle_offset);
+    if (!pending_code_invalidations.empty()) this->next_event_icount = 0;
+}
+
+template <typename BASE> void riscv_hart_msu_vp<BASE>::skip_time_polling() {
+    // the same code reading the time again after a few instructions without a store or a trap in between is
+    // considered to be a polling loop. Instead of executing it for every tick the time is advanced to the next
+    // tick or event. The translating backends do not update the PC per instruction but store it for SYSTEM
+    // instructions, i.e. CSR accesses
+    if (this->reg.PC == time_poll_pc && this->reg.icount - time_poll_icount < max_poll_loop_len) {
+        auto next_tick = ((this->reg.icount + cycle_offset) / rtc_divider + 1) * rtc_divider;
+        fast_forward(std::min(next_tick, next_event_cycle()));
+    }
+    time_poll_pc = this->reg.PC;
+    time_poll_icount = this->reg.icount;
+}
+
 template <typename BASE> iss::status riscv_hart_msu_vp<BASE>::read_time(unsigned addr, reg_t &val) {
-    uint64_t time_val = (this->reg.icount + cycle_offset) / (100000000 / 32768 - 1); //-> ~3052;
+    skip_time_polling();
+    uint64_t time_val = (this->reg.icount + cycle_offset) / rtc_divider;
     if (addr == time) {
         val = static_cast<reg_t>(time_val);
     } else if (addr == timeh) {
@@ -1014,11 +1307,26 @@ iss::status riscv_hart_msu_vp<BASE>::read_mem(phys_addr_t paddr, unsigned length
     if ((paddr.val + length) > mem.size()) return iss::Err;
     switch (paddr.val) {
     case 0x0200BFF8: { // CLINT base, mtime reg
+        // polling loops are not detected for loads as the translating backends do not provide their PC
         if (sizeof(reg_t) < length) return iss::Err;
-        reg_t time_val;
-        this->read_csr(time, time_val);
+        reg_t time_val = (this->reg.icount + cycle_offset) / rtc_divider;
         std::copy((uint8_t *)&time_val, ((uint8_t *)&time_val) + length, data);
     } break;
+    case 0x0200BFFC: { // CLINT base, upper half of mtime reg
+        if (length != 4) return iss::Err;
+        uint32_t time_h = ((this->reg.icount + cycle_offset) / rtc_divider) >> 32;
+        std::copy((uint8_t *)&time_h, ((uint8_t *)&time_h) + length, data);
+    } break;
+    case 0x02004000:   // CLINT base, mtimecmp reg
+    case 0x02004004: { // CLINT base, upper half of mtimecmp reg
+        auto offs = paddr.val - 0x02004000;
+        if (offs + length > sizeof(mtimecmp)) return iss::Err;
+        std::copy((uint8_t *)&mtimecmp + offs, (uint8_t *)&mtimecmp + offs + length, data);
+    } break;
+    case 0x02000000: { // CLINT base, msip reg
+        uint32_t msip = (csr[mip] >> 3) & 0x1;
+        std::copy((uint8_t *)&msip, ((uint8_t *)&msip) + std::min<unsigned>(length, sizeof(msip)), data);
+    } break;
     case 0x10008000: {
         const mem_type::page_type &p = mem(paddr.val / mem.page_size);
         uint64_t offs = paddr.val & mem.page_addr_mask;
@@ -1038,6 +1346,21 @@ template <typename BASE>
 iss::status riscv_hart_msu_vp<BASE>::write_mem(phys_addr_t paddr, unsigned length, const uint8_t *const data) {
     if ((paddr.val + length) > mem.size()) return iss::Err;
     switch (paddr.val) {
+    case 0x02004000:   // CLINT base, mtimecmp reg
+    case 0x02004004: { // CLINT base, upper half of mtimecmp reg
+        auto offs = paddr.val - 0x02004000;
+        if (offs + length > sizeof(mtimecmp)) return iss::Err;
+        std::copy(data, data + length, (uint8_t *)&mtimecmp + offs);
+        csr[mip] &= ~(1ULL << 7); // a write to mtimecmp clears MTIP, it is raised again once mtime reaches it
+        reschedule_events();
+    } break;
+    case 0x02000000: // CLINT base, msip reg
+        if (data[0] & 0x1)
+            csr[mip] |= 1ULL << 3;
+        else
+            csr[mip] &= ~(1ULL << 3);
+        check_interrupt();
+        break;
     case 0x10013000: // UART0 base, TXFIFO reg
     case 0x10023000: // UART1 base, TXFIFO reg
         uart_buf << (char)data[0];
@@ -1169,12 +1492,14 @@ typename riscv_hart_msu_vp<BASE>::phys_addr_t riscv_hart_msu_vp<BASE>::virt2phys
         return {addr.getAccessType(), addr.space, (pte & (~PGMASK)) | (addr.val & PGMASK)};
 #else
         // take exception if access or possibly dirty bit is not set.
-        if ((pte & ad) == ad)
+        if ((pte & ad) == ad) {
+            hart_stats.tlb_hits++;
             return {addr.access, addr.space, (pte & (~PGMASK)) | (addr.val & PGMASK)};
-        else
+        } else
             ptw.erase(it); // throw an exception
 #endif
     } else {
+        hart_stats.tlb_misses++;
         uint32_t mode = type != iss::access_type::FETCH && state.mstatus.MPRV ? // MPRV
                             state.mstatus.MPP :
                             this->reg.machine_state;
@@ -1250,6 +1575,8 @@ typename riscv_hart_msu_vp<BASE>::phys_addr_t riscv_hart_msu_vp<BASE>::virt2phys
 }
 
 template <typename BASE> uint64_t riscv_hart_msu_vp<BASE>::enter_trap(uint64_t flags, uint64_t addr) {
+    end_atomic_section(); // the faulting AMO or LR/SC does not access memory anymore
+    end_time_polling();
     auto cur_priv = this->reg.machine_state;
     // flags are ACTIVE[31:31], CAUSE[30:16], TRAPID[15:0]
     // calculate and write mcause val
@@ -1259,6 +1586,7 @@ template <typename BASE> uint64_t riscv_hart_msu_vp<BASE>::enter_trap(uint64_t f
     // calculate effective privilege level
     auto new_priv = PRIV_M;
     if (trap_id == 0) { // exception
+        hart_stats.traps++;
         if (cur_priv != PRIV_M && ((csr[medeleg] >> cause) & 0x1) != 0)
             new_priv = (csr[sedeleg] >> cause) & 0x1 ? PRIV_U : PRIV_S;
         // store ret addr in xepc register
@@ -1276,6 +1604,7 @@ template <typename BASE> uint64_t riscv_hart_msu_vp<BASE>::enter_trap(uint64_t f
         if (cur_priv != PRIV_M && ((csr[mideleg] >> cause) & 0x1) != 0)
             new_priv = (csr[sideleg] >> cause) & 0x1 ? PRIV_U : PRIV_S;
         csr[uepc | (new_priv << 8)] = this->reg.NEXT_PC; // store next address if interrupt
+        if ((flags & 0xffffffff) != 0xffffffff) hart_stats.interrupts++; // not the simulation end marker
         this->reg.pending_trap = 0;
     }
     size_t adr = ucause | (new_priv << 8);
@@ -1370,6 +1699,9 @@ template <typename BASE> void riscv_hart_msu_vp<BASE>::wait_until(uint64_t flags
     if (this->reg.machine_state == PRIV_S && tw != 0) {
         this->reg.trap_state = (1 << 31) | (2 << 16);
         this->fault_data = this->reg.PC;
+    } else if ((csr[mip] & csr[mie]) == 0) {
+        // nothing to wake up for yet, sleep until the next event instead of executing the idle loop
+        fast_forward(next_event_cycle());
     }
 }
 }
@@ -35,9 +35,11 @@
 #define _RV32GC_H_
 
 #include <array>
+#include <atomic>
 #include <iss/arch/traits.h>
 #include <iss/arch_if.h>
 #include <iss/vm_if.h>
+#include <limits>
 
 namespace iss {
 namespace arch {
@@ -213,7 +215,11 @@ struct rv32gc: public arch_if {
 
     inline uint64_t get_icount() { return reg.icount; }
 
-    inline bool should_stop() { return interrupt_sim; }
+    inline bool should_stop() {
+        // checked at block boundaries, timed events do not need to be polled per instruction
+        if (reg.icount >= next_event_icount || async_event) process_events();
+        return interrupt_sim;
+    }
 
     inline uint64_t stop_code() { return interrupt_sim; }
 
@@ -228,6 +234,8 @@ struct rv32gc: public arch_if {
     virtual phys_addr_t virt2phys(const iss::addr_t& addr);
 
     virtual iss::sync_type needed_sync() const { return iss::NO_SYNC; }
+    /// handle the timed events which became due, called once icount reaches next_event_icount
+    virtual void process_events() { next_event_icount = std::numeric_limits<uint64_t>::max(); }
 
     inline uint32_t get_last_branch() { return reg.last_branch; }
 
@@ -308,6 +316,11 @@ protected:
     
     uint64_t interrupt_sim=0;
 
+    uint64_t next_event_icount = std::numeric_limits<uint64_t>::max();
+
+    /// set by other threads to have process_events called at the next block boundary
+    std::atomic<bool> async_event{false};
+
 	uint32_t get_fcsr(){return reg.FCSR;}
 	void set_fcsr(uint32_t val){reg.FCSR = val;}		
 
@@ -0,0 +1,71 @@
+/*******************************************************************************
+ * Copyright (C) 2017, 2018 MINRES Technologies GmbH
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ *******************************************************************************/
+
+
+#ifndef _ISS_CODE_TRACKING_H_
+#define _ISS_CODE_TRACKING_H_
+
+#include <cstdint>
+#include <functional>
+
+namespace iss {
+/**
+ * interface of cores tracking the physical pages instructions have been fetched from. A store
+ * into such a page invalidates the code translated from it by means of the registered handler,
+ * hence self-modifying code and loaders copying code around work without flushing everything
+ */
+class code_tracking_if {
+public:
+    //! handler called with the physical address range [start, end) which has been modified
+    using invalidation_fn = std::function<void(uint64_t start, uint64_t end)>;
+
+    virtual ~code_tracking_if() = default;
+    /**
+     * register the handler to be called when a page containing fetched instructions is written to.
+     * The handler is called at the block boundary following the write, so the block doing the write
+     * may finish. Tracking is only active while a handler is registered
+     *
+     * @param handler the invalidation handler
+     */
+    virtual void set_code_invalidation_handler(invalidation_fn handler) = 0;
+    /**
+     * request the handler to be called for the physical address range [start, end). It may be called
+     * from any thread, the handler is called by the simulation thread at the next block boundary
+     *
+     * @param start the first address of the range
+     * @param end the address following the range
+     */
+    virtual void request_code_invalidation(uint64_t start, uint64_t end) = 0;
+};
+}
+
+#endif /* _ISS_CODE_TRACKING_H_ */
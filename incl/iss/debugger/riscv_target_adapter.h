@@ -34,12 +34,18 @@
 #define _ISS_DEBUGGER_RISCV_TARGET_ADAPTER_H_
 
 #include "iss/arch_if.h"
+#include "iss/memory_watch.h"
 #include <iss/arch/traits.h>
+#include <iss/debugger/encoderdecoder.h>
 #include <iss/debugger/target_adapter_base.h>
 #include <iss/iss.h>
+#include <iss/statistics.h>
 
 #include <array>
+#include <functional>
 #include <memory>
+#include <sstream>
+#include <string>
 #ifndef FMT_HEADER_ONLY
 #define FMT_HEADER_ONLY
 #endif
@@ -124,6 +130,33 @@ public:
 
     status remove_break(int type, uint64_t addr, unsigned int length) override;
 
+    status resume_from_current(bool step, int sig, rp_thread_ref thread,
+                               std::function<void(unsigned)> stop_callback) override;
+    /**
+     * check if a breakpoint is set at the physical address, used by the JIT backends while translating
+     *
+     * @param addr the physical address of the instruction
+     * @return true if there is a breakpoint
+     */
+    bool has_break(uint64_t addr) { return target_adapter_base::bp_lut.getEntry(addr) != 0; }
+    /**
+     * register the handler called with the physical address range [start, end) a breakpoint has been
+     * added to or removed from
+     */
+    void set_break_change_handler(std::function<void(uint64_t, uint64_t)> handler) {
+        break_change_handler = handler;
+    }
+    /**
+     * register the handler called before execution is resumed, its argument is true for a single step
+     */
+    void set_resume_handler(std::function<void(bool)> handler) { resume_handler = handler; }
+    /**
+     * get the reason of the last stop as stop reply fragment, e.g. 'watch:80001000' for a hit watchpoint
+     *
+     * @return the reason or an empty string if the core stopped for another reason
+     */
+    const std::string &get_stop_reason() const { return stop_reason; }
+
     status resume_from_addr(bool step, int sig, uint64_t addr, rp_thread_ref thread,
                             std::function<void(unsigned)> stop_callback) override;
 
@@ -134,8 +167,33 @@ protected:
 
     iss::arch_if *core;
     rp_thread_ref thread_idx;
+    std::function<void(uint64_t, uint64_t)> break_change_handler;
+    std::function<void(bool)> resume_handler;
+    std::string stop_reason;
 };
 
+/**
+ * register the monitor command 'stats' printing the runtime statistics of a VM and its core
+ *
+ * @param tgt_adapter the target adapter to register the command with
+ * @param vm the VM to report about
+ */
+inline void add_stats_command(target_adapter_if *tgt_adapter, iss::vm_if *vm) {
+    tgt_adapter->add_custom_command(
+        {"stats",
+         [vm](int argc, char *argv[], out_func of, data_func df) -> int {
+             std::stringstream ss;
+             ss << get_statistics(*vm);
+             auto str = ss.str();
+             of(str.c_str());
+             std::vector<char> buf(2 * str.size() + 1);
+             encoder_decoder().enc_string(str.c_str(), buf.data(), buf.size() - 1);
+             df(buf.data());
+             return Ok;
+         },
+         "print the runtime statistics of the core"});
+}
+
 template <typename ARCH> status riscv_target_adapter<ARCH>::set_gen_thread(rp_thread_ref &thread) {
     thread_idx = thread;
     return Ok;
@@ -322,9 +380,23 @@ template <typename ARCH> status riscv_target_adapter<ARCH>::packetsize_query(std
 }
 
 template <typename ARCH> status riscv_target_adapter<ARCH>::add_break(int type, uint64_t addr, unsigned int length) {
+    if (type >= 2) { // watchpoints: 2 - write, 3 - read, 4 - access
+        auto *watch = dynamic_cast<iss::memory_watch_if *>(core);
+        if (!watch) return Err;
+        // a hit stops the core at its next synchronization with the debugger
+        watch->set_watch_handler([this](uint64_t addr, bool is_write) {
+            stop_reason = fmt::format("{}:{:x}", is_write ? "watch" : "rwatch", addr);
+            LOG(INFO) << "Watchpoint hit, stopping with " << stop_reason;
+            target_adapter_base::stop();
+        });
+        watch->add_watch(addr, length, type != 2, type != 3);
+        LOG(TRACE) << "Adding watchpoint of type " << type << " for addr 0x" << std::hex << addr << std::dec;
+        return Ok;
+    }
     auto saddr = map_addr({iss::access_type::FETCH, iss::address_type::PHYSICAL, 0, addr});
     auto eaddr = map_addr({iss::access_type::FETCH, iss::address_type::PHYSICAL, 0, addr + length});
     target_adapter_base::bp_lut.addEntry(++target_adapter_base::bp_count, saddr.val, eaddr.val - saddr.val);
+    if (break_change_handler) break_change_handler(saddr.val, eaddr.val);
     LOG(TRACE) << "Adding breakpoint with handle " << target_adapter_base::bp_count << " for addr 0x" << std::hex
                << saddr.val << std::dec;
     LOG(TRACE) << "Now having " << target_adapter_base::bp_lut.size() << " breakpoints";
@@ -332,6 +404,11 @@ template <typename ARCH> status riscv_target_adapter<ARCH>::add_break(int type,
 }
 
 template <typename ARCH> status riscv_target_adapter<ARCH>::remove_break(int type, uint64_t addr, unsigned int length) {
+    if (type >= 2) {
+        auto *watch = dynamic_cast<iss::memory_watch_if *>(core);
+        LOG(TRACE) << "Removing watchpoint of type " << type << " for addr 0x" << std::hex << addr << std::dec;
+        return watch && watch->remove_watch(addr, length, type != 2, type != 3) ? Ok : Err;
+    }
     auto saddr = map_addr({iss::access_type::FETCH, iss::address_type::PHYSICAL, 0, addr});
     unsigned handle = target_adapter_base::bp_lut.getEntry(saddr.val);
     if (handle) {
@@ -339,6 +416,7 @@ template <typename ARCH> status riscv_target_adapter<ARCH>::remove_break(int typ
                    << std::dec;
         // TODO: check length of addr range
         target_adapter_base::bp_lut.removeEntry(handle);
+        if (break_change_handler) break_change_handler(saddr.val, saddr.val + length);
         LOG(TRACE) << "Now having " << target_adapter_base::bp_lut.size() << " breakpoints";
         return Ok;
     }
@@ -357,6 +435,14 @@ status riscv_target_adapter<ARCH>::resume_from_addr(bool step, int sig, uint64_t
     return resume_from_current(step, sig, thread, stop_callback);
 }
 
+template <typename ARCH>
+status riscv_target_adapter<ARCH>::resume_from_current(bool step, int sig, rp_thread_ref thread,
+                                                       std::function<void(unsigned)> stop_callback) {
+    if (resume_handler) resume_handler(step);
+    stop_reason.clear();
+    return target_adapter_base::resume_from_current(step, sig, thread, stop_callback);
+}
+
 template <typename ARCH> status riscv_target_adapter<ARCH>::target_xml_query(std::string &out_buf) {
     const std::string res{"<?xml version=\"1.0\"?><!DOCTYPE target SYSTEM \"gdb-target.dtd\">"
                           "<target><architecture>riscv:rv32</architecture>"
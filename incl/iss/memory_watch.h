@@ -0,0 +1,80 @@
+/*******************************************************************************
+ * Copyright (C) 2017, 2018 MINRES Technologies GmbH
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ *******************************************************************************/
+
+
+#ifndef _ISS_MEMORY_WATCH_H_
+#define _ISS_MEMORY_WATCH_H_
+
+#include <cstdint>
+#include <functional>
+
+namespace iss {
+/**
+ * interface of cores checking loads and stores against watched address ranges. The ranges are virtual
+ * addresses as used by the program (and the debugger), physical accesses are compared as they are. Only
+ * accesses to pages containing a watched range are compared against the ranges, all others are not slowed down
+ */
+class memory_watch_if {
+public:
+    //! handler called with the address of a load or store hitting a watched range
+    using watch_fn = std::function<void(uint64_t addr, bool is_write)>;
+
+    virtual ~memory_watch_if() = default;
+    /**
+     * watch an address range
+     *
+     * @param start the start address
+     * @param length the length of the range in bytes
+     * @param on_read report loads from the range
+     * @param on_write report stores to the range
+     */
+    virtual void add_watch(uint64_t start, uint64_t length, bool on_read, bool on_write) = 0;
+    /**
+     * stop watching an address range
+     *
+     * @param start the start address as given to add_watch
+     * @param length the length as given to add_watch
+     * @param on_read the load reporting as given to add_watch
+     * @param on_write the store reporting as given to add_watch
+     * @return true if the range was watched
+     */
+    virtual bool remove_watch(uint64_t start, uint64_t length, bool on_read, bool on_write) = 0;
+    /**
+     * register the handler to be called when a watched range is accessed
+     *
+     * @param handler the handler
+     */
+    virtual void set_watch_handler(watch_fn handler) = 0;
+};
+}
+
+#endif /* _ISS_MEMORY_WATCH_H_ */
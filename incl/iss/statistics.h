@@ -0,0 +1,107 @@
+/*******************************************************************************
+ * Copyright (C) 2017, 2018 MINRES Technologies GmbH
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ *******************************************************************************/
+
+
+#ifndef _ISS_STATISTICS_H_
+#define _ISS_STATISTICS_H_
+
+#include <iss/vm_if.h>
+#include <cstdint>
+#include <ostream>
+
+namespace iss {
+/**
+ * lightweight runtime counters of a simulation. The hart and the VM each add the
+ * counters they maintain, values not maintained by either of them stay 0
+ */
+struct statistics {
+    uint64_t instructions{0};            //!< instructions retired
+    uint64_t blocks_translated{0};       //!< number of translated blocks
+    uint64_t instructions_translated{0}; //!< number of instructions fed into the translator
+    uint64_t translation_ns{0};          //!< host time spent in decoding and code generation
+    uint64_t tlb_hits{0};                //!< virtual address translations served from the TLB
+    uint64_t tlb_misses{0};              //!< virtual address translations needing a page table walk
+    uint64_t traps{0};                   //!< synchronous exceptions taken
+    uint64_t interrupts{0};              //!< interrupts taken
+
+    statistics &operator+=(statistics const &o) {
+        instructions += o.instructions;
+        blocks_translated += o.blocks_translated;
+        instructions_translated += o.instructions_translated;
+        translation_ns += o.translation_ns;
+        tlb_hits += o.tlb_hits;
+        tlb_misses += o.tlb_misses;
+        traps += o.traps;
+        interrupts += o.interrupts;
+        return *this;
+    }
+};
+
+/**
+ * interface implemented by components maintaining runtime statistics
+ */
+class statistics_if {
+public:
+    virtual ~statistics_if() = default;
+    /**
+     * add the counters of this component to stats
+     *
+     * @param stats the statistics to update
+     */
+    virtual void collect_statistics(statistics &stats) const = 0;
+};
+/**
+ * collect the statistics of a VM and the core it simulates
+ *
+ * @param vm the virtual machine
+ * @return the accumulated statistics
+ */
+inline statistics get_statistics(vm_if &vm) {
+    statistics stats;
+    if (auto *core_stats = dynamic_cast<statistics_if *>(vm.get_arch())) core_stats->collect_statistics(stats);
+    if (auto *vm_stats = dynamic_cast<statistics_if *>(&vm)) vm_stats->collect_statistics(stats);
+    return stats;
+}
+
+inline std::ostream &operator<<(std::ostream &os, statistics const &stats) {
+    os << "instructions retired:    " << stats.instructions << "\n"
+       << "blocks translated:       " << stats.blocks_translated << "\n"
+       << "instructions translated: " << stats.instructions_translated << "\n"
+       << "translation time:        " << stats.translation_ns / 1e9 << "s\n"
+       << "TLB hits/misses:         " << stats.tlb_hits << "/" << stats.tlb_misses << "\n"
+       << "traps taken:             " << stats.traps << "\n"
+       << "interrupts taken:        " << stats.interrupts << "\n";
+    return os;
+}
+}
+
+#endif /* _ISS_STATISTICS_H_ */
@@ -0,0 +1,200 @@
+/*******************************************************************************
+ * Copyright (C) 2017, 2018 MINRES Technologies GmbH
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ *******************************************************************************/
+
+
+#ifndef _SYSC_SIFIVE_CORE_CLUSTER_H_
+#define _SYSC_SIFIVE_CORE_CLUSTER_H_
+
+#include "sysc/core_complex.h"
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+
+namespace sysc {
+namespace SiFive {
+/**
+ * a cluster of cores each executing its VM on a dedicated host thread. The cores run in parallel until
+ * the end of the current quantum where all of them rendezvous and the SystemC time is advanced. Bus
+ * accesses outside of DMI regions are executed by the SystemC thread of the cluster on behalf of the core,
+ * DMI invalidations and interrupts are applied while the core is halted. AMOs and LR/SC of the cores are
+ * serialized by the cluster and stores break the reservations of the other cores. Only the interp backend
+ * can be used as the JIT backends are not reentrant
+ */
+class core_cluster : public sc_core::sc_module {
+public:
+    sc_core::sc_vector<core_complex> cores;
+
+    core_cluster(sc_core::sc_module_name name, unsigned num_cores);
+
+    ~core_cluster();
+    /**
+     * execute a function in the context of the SystemC thread, called from the host thread of a core which
+     * is halted meanwhile
+     *
+     * @param core the calling core
+     * @param f the function to execute
+     */
+    void execute(core_complex &core, std::function<void()> const &f);
+    /**
+     * halt the calling core until the next quantum starts
+     *
+     * @param core the calling core
+     */
+    void rendezvous(core_complex &core);
+    /**
+     * halt the calling core until the SystemC thread is done with it, see execute_halted
+     *
+     * @param core the calling core
+     */
+    void halt(core_complex &core);
+    /**
+     * wait until no other core executes an atomic section and start the one of the calling core
+     *
+     * @param core the calling core
+     */
+    void enter_atomic_section(core_complex &core);
+    /**
+     * end the atomic section of the calling core
+     *
+     * @param core the calling core
+     * @param reserved true if the core holds a reservation of an LR
+     */
+    void leave_atomic_section(core_complex &core, bool reserved);
+    /**
+     * start a store which needs no serialization as no core executes an atomic section or holds a reservation.
+     * The store must not block as atomic sections wait for it
+     *
+     * @return false if the store has to be serialized by enter_store instead
+     */
+    inline bool enter_unserialized_store() {
+        ++unserialized_stores;
+        if (!serialize_stores) return true;
+        --unserialized_stores;
+        return false;
+    }
+    inline void leave_unserialized_store() { --unserialized_stores; }
+    /**
+     * wait until no other core executes an atomic section and drop the reservations of the other cores
+     * overlapping the store of the calling core. The store is part of the atomic section until leave_store
+     *
+     * @param core the calling core
+     * @param addr the physical address of the store
+     * @param length the number of bytes stored
+     * @return true if a new atomic section was started for the store
+     */
+    bool enter_store(core_complex &core, uint64_t addr, unsigned length);
+    /**
+     * end the atomic section started by enter_store
+     *
+     * @param core the calling core
+     */
+    void leave_store(core_complex &core);
+    /**
+     * execute a function if the core is halted, called from the SystemC thread
+     *
+     * @param core the core to be modified
+     * @param f the function modifying the core
+     * @return true if the core was halted and the function has been executed
+     */
+    template <typename F> bool when_halted(core_complex &core, F f) {
+        std::lock_guard<std::mutex> lock(mtx);
+        if (!core.halted) return false;
+        f();
+        return true;
+    }
+    /**
+     * execute a function while the core is halted, called from the SystemC thread. A running core is requested
+     * to halt at its next memory access or sync and waited for
+     *
+     * @param core the core to be modified
+     * @param f the function modifying the core
+     */
+    template <typename F> void execute_halted(core_complex &core, F f) {
+        std::unique_lock<std::mutex> lock(mtx);
+        if (!core.halted) {
+            core.request_halt();
+            kernel_cv.wait(lock, [&core]() { return core.halted; });
+        }
+        f();
+        if (core.halt_requested) {
+            core.halt_requested = false;
+            cores_cv.notify_all();
+        }
+    }
+
+protected:
+    struct request {
+        std::function<void()> const *fn;
+        bool done;
+    };
+    void run();
+    //! the host thread of a core, it (re)starts the VM whenever the SystemC thread starts the core
+    void execute_core(core_complex &core);
+    //! start the stopped cores which are neither in reset nor clock gated, called with the lock held
+    void start_cores();
+    /**
+     * mark the core as halted and wait until the predicate holds or the cluster shuts down, in the latter case
+     * the core is stopped
+     */
+    template <typename P> void wait_halted(std::unique_lock<std::mutex> &lock, core_complex &core, P pred);
+    std::mutex mtx;
+    //! notified when a core issued a request or halted
+    std::condition_variable kernel_cv;
+    //! notified when a request is done, the next quantum starts or a waiting core may continue
+    std::condition_variable cores_cv;
+    std::deque<request *> requests;
+    //! number of cores executing in the current quantum
+    unsigned running = 0;
+    //! number of cores whose VM did not terminate
+    unsigned active = 0;
+    uint64_t quantum_cnt = 0;
+    //! set when the cluster is destroyed while host threads still wait
+    bool shutdown = false;
+    //! the core executing an atomic section, nullptr if none
+    core_complex *atomic_owner = nullptr;
+    //! number of cores which may hold a reservation
+    unsigned reserving_cores = 0;
+    //! set while a core executes an atomic section or holds a reservation, stores are serialized then
+    std::atomic<bool> serialize_stores{false};
+    //! number of stores executing without serialization, atomic sections wait for them to finish
+    std::atomic<unsigned> unserialized_stores{0};
+    std::thread::id kernel_thread;
+    std::vector<std::thread> threads;
+};
+
+} /* namespace SiFive */
+} /* namespace sysc */
+
+#endif /* _SYSC_SIFIVE_CORE_CLUSTER_H_ */
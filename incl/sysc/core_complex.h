@@ -42,6 +42,17 @@
 #include <tlm_core/tlm_1/tlm_req_rsp/tlm_1_interfaces/tlm_core_ifs.h>
 #include <tlm_utils/tlm_quantumkeeper.h>
 #include <util/range_lut.h>
+#include <array>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <utility>
+#include <vector>
 
 class scv_tr_db;
 class scv_tr_stream;
@@ -50,6 +61,7 @@ template <class T_begin, class T_end> class scv_tr_generator;
 
 namespace iss {
 class vm_if;
+struct statistics;
 namespace arch {
 template <typename BASE> class riscv_hart_msu_vp;
 }
@@ -70,10 +82,51 @@ public:
     bool operator!=(const tlm_dmi_ext &o) const { return !operator==(o); }
 };
 
+/**
+ * a pool of generic payloads to be used for bus accesses. The payloads are memory managed and return to the
+ * pool once the last reference is released, extensions set as auto extensions are freed at this point
+ */
+class tlm_payload_pool : public tlm::tlm_mm_interface {
+public:
+    struct release_payload {
+        void operator()(tlm::tlm_generic_payload *gp) const { gp->release(); }
+    };
+    using payload_ptr = std::unique_ptr<tlm::tlm_generic_payload, release_payload>;
+    /**
+     * get a payload from the pool, the returned pointer holds a reference to it
+     */
+    payload_ptr allocate() {
+        tlm::tlm_generic_payload *gp;
+        if (free_list.empty()) {
+            payloads.emplace_back(new tlm::tlm_generic_payload(this));
+            gp = payloads.back().get();
+        } else {
+            gp = free_list.back();
+            free_list.pop_back();
+        }
+        gp->set_response_status(tlm::TLM_INCOMPLETE_RESPONSE);
+        gp->set_dmi_allowed(false);
+        gp->acquire();
+        return payload_ptr(gp);
+    }
+
+    void free(tlm::tlm_generic_payload *gp) override {
+        gp->reset();
+        free_list.push_back(gp);
+    }
+
+private:
+    std::vector<std::unique_ptr<tlm::tlm_generic_payload>> payloads;
+    std::vector<tlm::tlm_generic_payload *> free_list;
+};
+
 namespace SiFive {
 class core_wrapper;
+class core_cluster;
 
 class core_complex : public sc_core::sc_module, public scc::traceable {
+    friend class core_cluster;
+
 public:
     scc::initiator_mixin<scv4tlm::tlm_rec_initiator_socket<32>> initiator;
 
@@ -101,19 +154,40 @@ public:
 
     cci::cci_param<bool> dump_ir;
 
+    cci::cci_param<std::string> backend;
+
+    cci::cci_param<std::string> core_type;
+    //! size in bytes of the aligned lines read by instruction fetches from memory without DMI, 0 disables it
+    cci::cci_param<unsigned> fetch_buffer_size;
+    //! tick period of the timer behind mtime_o to extrapolate mtime by the local time, SC_ZERO_TIME disables it
+    cci::cci_param<sc_core::sc_time> mtime_period;
+
     core_complex(sc_core::sc_module_name name);
 
     ~core_complex();
 
+    /**
+     * advance the local time by the cycles executed since the last call and wait if the quantum is used up.
+     * Called at block boundaries and before bus accesses outside of DMI regions, the cycles are only converted
+     * to sc_time here
+     *
+     * @param cycle the current cycle count of the core
+     */
     inline void sync(uint64_t cycle) {
-        auto time = curr_clk * (cycle - last_sync_cycle);
-        quantum_keeper.inc(time);
-        if (quantum_keeper.need_sync()) {
-            wait(quantum_keeper.get_local_time());
-            quantum_keeper.reset();
-        }
+#ifdef WITH_SCV
+        if (instr_record_cnt) flush_instr_records();
+#endif
+        if (cycle > last_sync_cycle) quantum_keeper.inc(curr_clk * static_cast<double>(cycle - last_sync_cycle));
         last_sync_cycle = cycle;
+        if (halt_requested) halt_on_request();
+        // other cores may wait for the end of an atomic section, hence it is not interrupted by the quantum end
+        if (need_sync() && !in_atomic_section) end_quantum();
+        sync_limit_cycle = compute_sync_limit(cycle);
     }
+    /**
+     * get the cycle at which the local time reaches the end of the current quantum
+     */
+    inline uint64_t next_sync_cycle() const { return sync_limit_cycle; }
 
     bool read_mem(uint64_t addr, unsigned length, uint8_t *const data, bool is_fetch);
 
@@ -122,11 +196,39 @@ public:
     bool read_mem_dbg(uint64_t addr, unsigned length, uint8_t *const data);
 
     bool write_mem_dbg(uint64_t addr, unsigned length, const uint8_t *const data);
+    /**
+     * synchronize the local time and wait until the event is notified or, if running in a cluster, until the
+     * next quantum boundary
+     *
+     * @param evt the event notified upon an interrupt
+     * @return the number of clock cycles slept
+     */
+    uint64_t wait_for_interrupt(sc_core::sc_event &evt);
+    /**
+     * get the value of the timer connected to mtime_o at the given cycle of the core
+     *
+     * @param cycle the current cycle count of the core
+     * @param val the timer value
+     * @return true if the timer could be read
+     */
+    bool read_mtime(uint64_t cycle, uint64_t &val);
+    /**
+     * serialize the memory accesses of an AMO or LR/SC with the other cores of the cluster
+     */
+    void enter_atomic_section();
+    /**
+     * end the atomic section started by enter_atomic_section
+     *
+     * @param reserved true if the core holds a reservation of an LR
+     */
+    void leave_atomic_section(bool reserved);
 
     void trace(sc_core::sc_trace_file *trf) const override;
 
     void disass_output(uint64_t pc, const std::string instr);
 
+    iss::statistics get_statistics() const;
+
 protected:
     void before_end_of_elaboration() override;
     void start_of_simulation() override;
@@ -136,14 +238,119 @@ protected:
     void sw_irq_cb();
     void timer_irq_cb();
     void global_irq_cb();
+    void set_irq(short id, bool value);
+    void prepare_run();
+    /**
+     * start the core of a cluster without waiting, it stays in reset while rst_i is asserted
+     *
+     * @return true if the core may run
+     */
+    bool try_start_run();
+    void start_run();
+    bool execution_interrupted();
+    void end_quantum();
+    void invalidate_dmi(uint64_t start, uint64_t end);
+    void apply_deferred_updates();
+    void update_clk();
+    void stop_execution();
+    void request_halt();
+    void halt_on_request();
+    bool break_reservation(uint64_t addr, unsigned length);
+    bool write_dmi(uint64_t addr, unsigned length, const uint8_t *const data);
+    /**
+     * start a new quantum. The SystemC time and the end of the quantum are cached as the host thread of a core
+     * in a cluster must not call into the SystemC kernel
+     */
+    void reset_quantum();
+    inline sc_core::sc_time current_time() const {
+        return cluster ? quantum_start + quantum_keeper.get_local_time() : quantum_keeper.get_current_time();
+    }
+    inline bool need_sync() const { return cluster ? current_time() >= quantum_end : quantum_keeper.need_sync(); }
+    uint64_t compute_sync_limit(uint64_t cycle) const;
+    bool read_bus(uint64_t addr, unsigned length, uint8_t *const data, bool is_fetch);
+    bool write_bus(uint64_t addr, unsigned length, const uint8_t *const data);
+    bool transport_read(uint64_t addr, unsigned length, uint8_t *const data, bool is_fetch);
+    bool transport_write(uint64_t addr, unsigned length, const uint8_t *const data);
+    inline void invalidate_fetch_buf(uint64_t addr, unsigned length) {
+        if (addr < fetch_buf_addr + fetch_buf_len && addr + length > fetch_buf_addr) fetch_buf_len = 0;
+    }
+    inline void track_fetch_page(uint64_t addr) {
+        auto page = addr >> code_page_shift;
+        auto &word = code_pages[(page >> 6) % code_pages.size()];
+        if (!(word.load(std::memory_order_relaxed) & (1ULL << (page & 63))))
+            word.fetch_or(1ULL << (page & 63), std::memory_order_relaxed);
+    }
+    /**
+     * have the other cores drop the code they translated from the memory modified by a store of this core
+     *
+     * @param addr the physical address of the store
+     * @param length the number of bytes stored
+     */
+    void notify_store(uint64_t addr, unsigned length);
+    bool write_cluster_mem(uint64_t addr, unsigned length, const uint8_t *const data);
+    /**
+     * get the DMI region covering the access, the last region hit is checked before searching the lookup table.
+     * The returned entry has no access granted if there is none
+     */
+    inline tlm_dmi_ext &get_dmi_entry(util::range_lut<tlm_dmi_ext> &lut, tlm_dmi_ext &mru, uint64_t addr,
+                                      unsigned length) {
+        if (mru.get_granted_access() == tlm::tlm_dmi::DMI_ACCESS_NONE || addr < mru.get_start_address() ||
+            addr + length > mru.get_end_address() + 1) {
+            auto lut_entry = lut.getEntry(addr);
+            if (lut_entry.get_granted_access() == tlm::tlm_dmi::DMI_ACCESS_NONE ||
+                addr + length > lut_entry.get_end_address() + 1)
+                return no_dmi;
+            mru = lut_entry;
+        }
+        return mru;
+    }
     uint64_t last_sync_cycle = 0;
+    uint64_t sync_limit_cycle = 0;
     util::range_lut<tlm_dmi_ext> read_lut, write_lut;
+    // last DMI regions hit by instruction fetches, loads and stores. The DMI pointers are not handed to the hart or
+    // to the translated code: dbt-core emits the memory accesses of the JIT backends as calls into the VM, and every
+    // access has to pass the halt check guarding DMI invalidations, the fetch buffer and the store serialization
+    tlm_dmi_ext fetch_mru, read_mru, write_mru, no_dmi;
     tlm_utils::tlm_quantumkeeper quantum_keeper;
     std::vector<uint8_t> write_buf;
+    std::vector<uint8_t> fetch_buf;
+    uint64_t fetch_buf_addr = 0;
+    uint64_t fetch_buf_len = 0;
+    //! set by the bus stores of other cores, the fetch buffer is refilled before its next use
+    std::atomic<bool> fetch_buf_stale{false};
+    //! the pages instructions were fetched from, hashed by page number. Only stores of other cores test them
+    static constexpr unsigned code_page_shift = 12;
+    std::array<std::atomic<uint64_t>, 64> code_pages{};
+    //! all cores of the simulation, they are notified about the stores of each other
+    static std::vector<core_complex *> all_cores;
+    // the last value peeked from mtime_o and the SystemC time it was peeked at
+    bool mtime_valid = false;
+    uint64_t mtime_val = 0;
+    sc_core::sc_time mtime_stamp;
+    tlm_payload_pool payload_pool;
     std::unique_ptr<core_wrapper> cpu;
     std::unique_ptr<iss::vm_if> vm;
     sc_core::sc_time curr_clk;
     iss::debugger::target_adapter_if *tgt_adapter;
+    //! the cluster executing the core on a host thread, nullptr if the core runs in its own SC_THREAD
+    core_cluster *cluster = nullptr;
+    //! set by the cluster while the host thread of the core waits, guarded by the mutex of the cluster
+    bool halted = true;
+    //! set while the VM of the core is stopped by reset or clock gating or terminated, guarded like halted
+    bool stopped = true;
+    bool terminated = false;
+    //! set by the SystemC thread of the cluster to have the host thread halt at its next memory access or sync
+    std::atomic<bool> halt_requested{false};
+    //! true while the core executes an AMO, LR/SC or serialized store, only accessed by its host thread
+    bool in_atomic_section = false;
+    //! true if the core may hold a reservation of an LR, guarded by the mutex of the cluster
+    bool reserving = false;
+    // the SystemC time at the start and at the end of the current quantum, set by the cluster
+    sc_core::sc_time quantum_start, quantum_end;
+    // interrupt, clock and reset changes received while running on the host thread
+    std::vector<std::pair<short, bool>> deferred_irqs;
+    bool deferred_clk = false;
+    bool deferred_stop = false;
 #ifdef WITH_SCV
     //! transaction recording database
     scv_tr_db *m_db;
@@ -153,6 +360,52 @@ protected:
     scv_tr_generator<_scv_tr_generator_default_data, _scv_tr_generator_default_data> *instr_tr_handle;
     scv_tr_generator<uint64_t, _scv_tr_generator_default_data> *fetch_tr_handle;
     scv_tr_handle tr_handle;
+    //! an executed instruction to be recorded
+    struct instr_record {
+        uint64_t pc;
+        uint64_t cycle;
+        uint64_t mstatus;
+        uint32_t mode;
+        std::shared_ptr<const std::string> text;
+    };
+    //! buffered instructions handed over to the writer thread with the time base of their cycles
+    struct instr_batch {
+        std::vector<instr_record> records;
+        size_t cnt;
+        sc_core::sc_time sync_time;
+        uint64_t sync_cycle;
+        sc_core::sc_time clk;
+    };
+    //! disassembly of the executed instructions by address, it is dropped once it holds max_instr_texts entries
+    std::unordered_map<uint64_t, std::shared_ptr<const std::string>> instr_texts;
+    static constexpr size_t max_instr_texts = 1 << 16;
+    //! number of instructions being buffered before they are handed over to the writer thread
+    static constexpr size_t max_instr_records = 1024;
+    //! number of batches queued for the writer thread before the core waits for it
+    static constexpr size_t max_instr_batches = 16;
+    std::vector<instr_record> instr_records;
+    size_t instr_record_cnt = 0;
+    std::mutex instr_mtx;
+    //! notified when a batch is queued or has been recorded
+    std::condition_variable instr_cv;
+    std::deque<instr_batch> instr_queue;
+    std::vector<std::vector<instr_record>> instr_free;
+    bool instr_writer_stop = false;
+    std::thread instr_writer;
+    /**
+     * serializes the writer threads with the SystemC code of a cluster as the database is not thread safe.
+     * SystemC code of a core runs only after its writer thread is idle, see wait_instr_records
+     */
+    static std::mutex recording_mtx;
+    //! hand the buffered instructions over to the writer thread, called at synchronization points
+    void flush_instr_records();
+    /**
+     * flush the buffered instructions and wait until all of them are recorded, called before the core calls
+     * into SystemC so that the bus accesses can refer to the transaction of the current instruction
+     */
+    void wait_instr_records();
+    void write_instr_records();
+    void record_instructions(instr_batch const &batch);
 #endif
 };
 
@@ -0,0 +1,261 @@
+/*******************************************************************************
+ * Copyright (C) 2017, 2018 MINRES Technologies GmbH
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ *******************************************************************************/
+
+
+#include <iss/iss.h>
+
+#include <boost/program_options.hpp>
+#include <iss/arch/riscv_hart_msu_vp.h>
+#include <iss/arch/rv32imac.h>
+#include <iss/arch/rv32gc.h>
+#include <iss/arch/rv64gc.h>
+#include <iss/arch/rv64i.h>
+#include <iss/arch/mnrv32.h>
+#ifdef WITH_LLVM
+#include <iss/llvm/jit_helper.h>
+#endif
+#include <iss/log_categories.h>
+#include <iss/statistics.h>
+#include <json/json.h>
+
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+namespace po = boost::program_options;
+
+namespace {
+const std::array<const char*, 5> all_isas{{"rv32imac", "rv32gc", "rv64i", "rv64gc", "mnrv32"}};
+#ifdef WITH_LLVM
+const std::array<const char*, 3> all_backends{{"interp", "tcc", "llvm"}};
+#else
+const std::array<const char*, 2> all_backends{{"interp", "tcc"}};
+#endif
+
+template<typename CORE>
+std::unique_ptr<iss::vm_if> create_vm(CORE* core, std::string const& backend){
+    if(backend == "interp")
+        return iss::interp::create(core, 0);
+#ifdef WITH_LLVM
+    if(backend == "llvm")
+        return iss::llvm::create(core, 0);
+#endif
+    if(backend == "tcc")
+        return iss::tcc::create(core, 0);
+    return nullptr;
+}
+
+/**
+ * runs a single kernel and fills the measurement into result. The run takes place in a forked child
+ * process so that every measurement starts with a clean process image and the reported peak resident
+ * set size is the one of this very run.
+ */
+template<typename CORE>
+void run_kernel(std::string const& backend, std::string const& elf, uint64_t instructions, Json::Value& result){
+    std::unique_ptr<iss::arch::riscv_hart_msu_vp<CORE>> core{new iss::arch::riscv_hart_msu_vp<CORE>()};
+    auto vm = create_vm(core.get(), backend);
+    if(!vm){
+        result["error"] = "unsupported backend";
+        return;
+    }
+    auto start_addr = core->load_file(elf);
+    vm->reset(start_addr.second ? start_addr.first : 0);
+    auto start = std::chrono::high_resolution_clock::now();
+    auto res = vm->start(instructions, false);
+    auto duration = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+    auto icount = core->get_icount();
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    result["exit_code"] = res;
+    result["instructions"] = Json::UInt64(icount);
+    result["seconds"] = duration;
+    result["mips"] = duration > 0 ? icount / duration / 1e6 : 0.0;
+    result["max_rss_kb"] = Json::Int64(usage.ru_maxrss);
+    auto stats = iss::get_statistics(*vm);
+    result["blocks_translated"] = Json::UInt64(stats.blocks_translated);
+    result["instructions_translated"] = Json::UInt64(stats.instructions_translated);
+    result["translation_seconds"] = stats.translation_ns / 1e9;
+    result["tlb_misses"] = Json::UInt64(stats.tlb_misses);
+    result["traps"] = Json::UInt64(stats.traps);
+    result["interrupts"] = Json::UInt64(stats.interrupts);
+}
+
+void run_kernel(std::string const& isa, std::string const& backend, std::string const& elf, uint64_t instructions,
+                Json::Value& result){
+    try {
+        if (isa=="mnrv32")
+            run_kernel<iss::arch::mnrv32>(backend, elf, instructions, result);
+        else if (isa=="rv64i")
+            run_kernel<iss::arch::rv64i>(backend, elf, instructions, result);
+        else if (isa=="rv64gc")
+            run_kernel<iss::arch::rv64gc>(backend, elf, instructions, result);
+        else if (isa=="rv32imac")
+            run_kernel<iss::arch::rv32imac>(backend, elf, instructions, result);
+        else if (isa=="rv32gc")
+            run_kernel<iss::arch::rv32gc>(backend, elf, instructions, result);
+        else
+            result["error"] = "unsupported isa";
+    } catch (std::exception &e) {
+        result["error"] = e.what();
+    }
+}
+
+Json::Value run_isolated(std::string const& isa, std::string const& backend, std::string const& elf,
+                         uint64_t instructions){
+    Json::Value result;
+    int fds[2];
+    if(pipe(fds)!=0){
+        result["error"] = "could not create pipe";
+        return result;
+    }
+    auto pid = fork();
+    if(pid==0){
+        close(fds[0]);
+        run_kernel(isa, backend, elf, instructions, result);
+        auto str = Json::FastWriter().write(result);
+        auto written = write(fds[1], str.c_str(), str.size());
+        close(fds[1]);
+        _exit(written==static_cast<ssize_t>(str.size())?0:1);
+    }
+    close(fds[1]);
+    std::string str;
+    char buf[256];
+    for(auto len = read(fds[0], buf, sizeof(buf)); len>0; len = read(fds[0], buf, sizeof(buf)))
+        str.append(buf, len);
+    close(fds[0]);
+    int status = 0;
+    if(pid>0) waitpid(pid, &status, 0);
+    if(pid<0 || !Json::Reader().parse(str, result) || !WIFEXITED(status)){
+        result = Json::Value();
+        result["error"] = WIFSIGNALED(status) ? std::string("terminated by signal ")+std::to_string(WTERMSIG(status)):"no result";
+    }
+    return result;
+}
+
+std::string expand_isa(std::string path, std::string const& isa){
+    for(auto pos = path.find("${isa}"); pos!=std::string::npos; pos = path.find("${isa}"))
+        path.replace(pos, 6, isa);
+    return path;
+}
+
+template<typename T> std::vector<std::string> as_strings(Json::Value const& val, T const& dflt){
+    std::vector<std::string> ret;
+    if(val.isArray())
+        for(auto const& v:val) ret.push_back(v.asString());
+    else
+        ret.assign(dflt.begin(), dflt.end());
+    return ret;
+}
+}
+
+int main(int argc, char *argv[]) {
+    po::variables_map clim;
+    po::options_description desc("Options");
+    // clang-format off
+    desc.add_options()
+        ("help,h", "Print help message")
+        ("verbose,v", po::value<int>()->implicit_value(0), "Sets logging verbosity")
+        ("suite,s", po::value<std::string>()->required(), "JSON file describing the benchmark kernels")
+        ("output,o", po::value<std::string>(), "file to write the JSON report to instead of stdout")
+        ("instructions,i", po::value<uint64_t>(), "max. number of instructions per kernel, overrides the suite setting")
+        ("isa", po::value<std::vector<std::string>>(), "restrict the run to the given isa(s)")
+        ("backend", po::value<std::vector<std::string>>(), "restrict the run to the given backend(s)");
+    // clang-format on
+    try {
+        po::store(po::parse_command_line(argc, argv, desc), clim); // can throw
+        if (clim.count("help")) {
+            std::cout << "DBT-RISE-RiscV throughput benchmark" << std::endl << desc << std::endl;
+            return 0;
+        }
+        po::notify(clim); // throws on error, so do after help in case
+    } catch (po::error &e) {
+        std::cerr << "ERROR: " << e.what() << std::endl << std::endl;
+        std::cerr << desc << std::endl;
+        return 1;
+    }
+    LOGGER(DEFAULT)::print_time() = false;
+    LOGGER(DEFAULT)::reporting_level() =
+        clim.count("verbose") ? logging::as_log_level(clim["verbose"].as<int>()) : logging::WARNING;
+#ifdef WITH_LLVM
+    iss::init_jit_debug(argc, argv);
+#endif
+    auto suite_name = clim["suite"].as<std::string>();
+    Json::Value suite;
+    std::ifstream is(suite_name);
+    if (!is.is_open()) {
+        LOG(ERROR) << "Could not open suite file " << suite_name;
+        return 1;
+    }
+    try {
+        is >> suite;
+    } catch (Json::RuntimeError &e) {
+        LOG(ERROR) << "Could not parse suite file " << suite_name << ", reason: " << e.what();
+        return 1;
+    }
+    auto base_dir = suite_name.find('/') == std::string::npos ? std::string{} : suite_name.substr(0, suite_name.rfind('/') + 1);
+    uint64_t instructions = clim.count("instructions") ? clim["instructions"].as<uint64_t>()
+                                                       : suite.get("instructions", Json::UInt64(100000000)).asUInt64();
+    auto isa_filter = clim.count("isa") ? clim["isa"].as<std::vector<std::string>>() : std::vector<std::string>{};
+    auto backends = clim.count("backend") ? clim["backend"].as<std::vector<std::string>>()
+                                          : std::vector<std::string>(all_backends.begin(), all_backends.end());
+    Json::Value report;
+    report["suite"] = suite_name;
+    report["instructions_limit"] = Json::UInt64(instructions);
+    auto failed = 0U;
+    for (auto const& kernel : suite["kernels"]) {
+        for (auto const& isa : as_strings(kernel["isa"], all_isas)) {
+            if (isa_filter.size() && std::find(isa_filter.begin(), isa_filter.end(), isa) == isa_filter.end()) continue;
+            auto elf = expand_isa(kernel["elf"].asString(), isa);
+            if (elf.size() && elf[0] != '/') elf = base_dir + elf;
+            for (auto const& backend : backends) {
+                LOG(INFO) << "running " << kernel["name"].asString() << " on " << isa << "/" << backend;
+                auto result = run_isolated(isa, backend, elf, instructions);
+                result["kernel"] = kernel["name"];
+                result["isa"] = isa;
+                result["backend"] = backend;
+                result["elf"] = elf;
+                if (result.isMember("error")) ++failed;
+                report["results"].append(result);
+            }
+        }
+    }
+    if (clim.count("output")) {
+        std::ofstream os(clim["output"].as<std::string>());
+        os << report;
+    } else
+        std::cout << report << std::endl;
+    return failed ? 1 : 0;
+}
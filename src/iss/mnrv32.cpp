@@ -53,7 +53,7 @@ mnrv32::mnrv32() {
 mnrv32::~mnrv32() = default;
 
 void mnrv32::reset(uint64_t address) {
-    for(size_t i=0; i<traits<mnrv32>::NUM_REGS; ++i) set_reg(i, std::vector<uint8_t>(sizeof(traits<mnrv32>::reg_t),0));
+    reg = MNRV32_regs();
     reg.PC=address;
     reg.NEXT_PC=reg.PC;
     reg.trap_state=0;
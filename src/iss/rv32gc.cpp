@@ -54,7 +54,7 @@ rv32gc::~rv32gc(){
 }
 
 void rv32gc::reset(uint64_t address) {
-    for(size_t i=0; i<traits<rv32gc>::NUM_REGS; ++i) set_reg(i, std::vector<uint8_t>(sizeof(traits<rv32gc>::reg_t),0));
+    reg = RV32GC_regs();
     reg.PC=address;
     reg.NEXT_PC=reg.PC;
     reg.trap_state=0;
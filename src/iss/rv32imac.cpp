@@ -54,8 +54,7 @@ rv32imac::rv32imac() {
 rv32imac::~rv32imac() = default;
 
 void rv32imac::reset(uint64_t address) {
-    for (size_t i = 0; i < traits<rv32imac>::NUM_REGS; ++i)
-        set_reg(i, std::vector<uint8_t>(sizeof(traits<rv32imac>::reg_t), 0));
+    reg = RV32IMAC_regs();
     reg.PC = address;
     reg.NEXT_PC = reg.PC;
     reg.trap_state = 0;
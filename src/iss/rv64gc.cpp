@@ -55,7 +55,7 @@ rv64gc::rv64gc() {
 rv64gc::~rv64gc() = default;
 
 void rv64gc::reset(uint64_t address) {
-    for(size_t i=0; i<traits<rv64gc>::NUM_REGS; ++i) set_reg(i, std::vector<uint8_t>(sizeof(traits<rv64gc>::reg_t),0));
+    reg = RV64GC_regs();
     reg.PC=address;
     reg.NEXT_PC=reg.PC;
     reg.trap_state=0;
@@ -53,7 +53,7 @@ rv64i::rv64i() {
 rv64i::~rv64i() = default;
 
 void rv64i::reset(uint64_t address) {
-    for(size_t i=0; i<traits<rv64i>::NUM_REGS; ++i) set_reg(i, std::vector<uint8_t>(sizeof(traits<rv64i>::reg_t),0));
+    reg = RV64I_regs();
     reg.PC=address;
     reg.NEXT_PC=reg.PC;
     reg.trap_state=0;
@@ -47,24 +47,233 @@
 #include <iss/log_categories.h>
 #include <iss/plugin/cycle_estimate.h>
 #include <iss/plugin/instruction_count.h>
+#include <iss/statistics.h>
+
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <new>
+#include <sstream>
+#include <thread>
 
 namespace po = boost::program_options;
 
 using cpu_ptr = std::unique_ptr<iss::arch_if>;
 using vm_ptr= std::unique_ptr<iss::vm_if>;
+using icount_fn = std::function<uint64_t()>;
+using reset_fn = std::function<void()>;
 
 template<typename CORE>
-std::tuple<cpu_ptr, vm_ptr> create_cpu(std::string const& backend, unsigned gdb_port){
-    CORE* lcpu = new iss::arch::riscv_hart_msu_vp<CORE>();
+std::tuple<cpu_ptr, vm_ptr, icount_fn, reset_fn> create_cpu(std::string const& backend, unsigned gdb_port){
+    using hart_type = iss::arch::riscv_hart_msu_vp<CORE>;
+    auto* lcpu = new hart_type();
+    icount_fn icount = [lcpu]() { return lcpu->get_icount(); };
+    // brings the hart into its power-on state, memory included, by constructing it anew in place so that the VM
+    // keeps referring to it. The VM drops the code it translated for the previous program
+    reset_fn power_on_reset = [lcpu]() {
+        auto handler = lcpu->get_code_invalidation_handler();
+        lcpu->~hart_type();
+        new (lcpu) hart_type();
+        if (handler) {
+            lcpu->set_code_invalidation_handler(handler);
+            handler(0, std::numeric_limits<uint64_t>::max());
+        }
+    };
     if(backend == "interp")
-        return {cpu_ptr{lcpu}, vm_ptr{iss::interp::create(lcpu, gdb_port)}};
+        return {cpu_ptr{lcpu}, vm_ptr{iss::interp::create<CORE>(lcpu, gdb_port)}, icount, power_on_reset};
 #ifdef WITH_LLVM
     if(backend == "llvm")
-        return {cpu_ptr{lcpu}, vm_ptr{iss::llvm::create(lcpu, gdb_port)}};
+        return {cpu_ptr{lcpu}, vm_ptr{iss::llvm::create<CORE>(lcpu, gdb_port)}, icount, power_on_reset};
 #endif
     if(backend == "tcc")
-        return {cpu_ptr{lcpu}, vm_ptr{iss::tcc::create(lcpu, gdb_port)}};
-    return {nullptr, nullptr};
+        return {cpu_ptr{lcpu}, vm_ptr{iss::tcc::create<CORE>(lcpu, gdb_port)}, icount, power_on_reset};
+    delete lcpu;
+    return {nullptr, nullptr, nullptr, nullptr};
+}
+
+std::tuple<cpu_ptr, vm_ptr, icount_fn, reset_fn> create_cpu(std::string const& isa, std::string const& backend,
+                                                            unsigned gdb_port){
+    if (isa=="mnrv32")
+        return create_cpu<iss::arch::mnrv32>(backend, gdb_port);
+    if (isa=="rv64i")
+        return create_cpu<iss::arch::rv64i>(backend, gdb_port);
+    if (isa=="rv64gc")
+        return create_cpu<iss::arch::rv64gc>(backend, gdb_port);
+    if (isa=="rv32imac")
+        return create_cpu<iss::arch::rv32imac>(backend, gdb_port);
+    if (isa=="rv32gc")
+        return create_cpu<iss::arch::rv32gc>(backend, gdb_port);
+    return {nullptr, nullptr, nullptr, nullptr};
+}
+
+bool register_plugins(iss::vm_if& vm, std::vector<std::string> const& plugins, std::vector<iss::vm_plugin *>& plugin_list,
+        std::string const& dflt_filename = "cycles.txt"){
+    for (std::string const& opt_val : plugins) {
+        std::string plugin_name=opt_val;
+        std::string filename{dflt_filename};
+        std::size_t found = opt_val.find('=');
+        if (found != std::string::npos) {
+            plugin_name = opt_val.substr(0, found);
+            filename = opt_val.substr(found + 1, opt_val.size());
+        }
+        if (plugin_name == "ic") {
+            auto *ic_plugin = new iss::plugin::instruction_count(filename);
+            vm.register_plugin(*ic_plugin);
+            plugin_list.push_back(ic_plugin);
+        } else if (plugin_name == "ce") {
+            auto *ce_plugin = new iss::plugin::cycle_estimate(filename);
+            vm.register_plugin(*ce_plugin);
+            plugin_list.push_back(ce_plugin);
+        } else {
+            LOG(ERROR) << "Unknown plugin name: " << plugin_name << ", valid names are 'ce', 'ic'" << std::endl;
+            return false;
+        }
+    }
+    return true;
+}
+
+uint64_t parse_address(std::string const& str){
+    return str.find("0x") == 0 ? std::stoull(str.substr(2), nullptr, 16) : std::stoull(str, nullptr, 10);
+}
+
+/**
+ * a single simulation run of the batch mode, described by one line of the job file:
+ *   <elf file> [isa=<isa>] [backend=<backend>] [instructions=<count>] [reset=<address>] [plugin=<plugin>]...
+ */
+struct batch_job {
+    size_t id;
+    std::string elf;
+    std::string isa;
+    std::string backend;
+    uint64_t instructions;
+    std::string reset;
+    std::vector<std::string> plugins;
+    int result{0};
+    uint64_t icount{0};
+    double duration{0.0};
+};
+
+std::vector<batch_job> read_job_file(std::string const& name, batch_job const& dflt){
+    std::vector<batch_job> jobs;
+    std::ifstream is(name);
+    if(!is.is_open())
+        throw std::runtime_error("could not open job file "+name);
+    std::string line;
+    while(std::getline(is, line)){
+        auto comment = line.find('#');
+        if(comment!=std::string::npos) line.erase(comment);
+        std::istringstream ls(line);
+        std::string token;
+        if(!(ls>>token)) continue;
+        batch_job job{dflt};
+        job.id=jobs.size();
+        job.elf=token;
+        while(ls>>token){
+            auto found = token.find('=');
+            auto key = token.substr(0, found);
+            auto val = found==std::string::npos? std::string{}:token.substr(found+1);
+            if(key=="isa") job.isa=val;
+            else if(key=="backend") job.backend=val;
+            else if(key=="instructions") job.instructions=std::stoull(val);
+            else if(key=="reset") job.reset=val;
+            else if(key=="plugin") job.plugins.push_back(val);
+            else throw std::runtime_error("unknown job attribute '"+token+"' in "+name);
+        }
+        jobs.push_back(job);
+    }
+    return jobs;
+}
+
+/**
+ * a hart with its VM, kept by a worker for the following jobs using the same core type and backend
+ */
+struct core_instance {
+    cpu_ptr cpu;
+    vm_ptr vm;
+    icount_fn icount;
+    reset_fn power_on_reset;
+};
+
+using core_cache = std::map<std::pair<std::string, std::string>, core_instance>;
+
+/**
+ * runs a job on a core in its power-on state. The core and its VM are reused from the previous job of the
+ * worker with the same core type and backend, the decoding tables are shared by all VMs of a core type anyway.
+ * Plugins cannot be removed from a VM, hence jobs with plugins get a core of their own. Plugins without an
+ * explicit file name write to cycles_<job number>.txt so that jobs do not overwrite each others output.
+ */
+int run_job(batch_job& job, core_cache& cache){
+    auto start = std::chrono::high_resolution_clock::now();
+    core_instance own_core;
+    auto& core = job.plugins.empty() ? cache[{job.isa, job.backend}] : own_core;
+    if(core.vm)
+        core.power_on_reset();
+    else
+        std::tie(core.cpu, core.vm, core.icount, core.power_on_reset) = create_cpu(job.isa, job.backend, 0);
+    if(!core.vm){
+        LOG(ERROR) << "Illegal isa/backend combination " << job.isa << "/" << job.backend << " for " << job.elf << std::endl;
+        return job.result=127;
+    }
+    auto& vm = core.vm;
+    std::vector<iss::vm_plugin *> plugin_list;
+    if(register_plugins(*vm, job.plugins, plugin_list, "cycles_"+std::to_string(job.id)+".txt")) {
+        try {
+            auto start_addr = vm->get_arch()->load_file(job.elf);
+            uint64_t start_address = start_addr.second? start_addr.first : 0;
+            if (job.reset.size())
+                start_address = parse_address(job.reset);
+            vm->reset(start_address);
+            job.result = vm->start(job.instructions, false);
+            job.icount = core.icount();
+        } catch (std::exception &e) {
+            LOG(ERROR) << "Exception while running " << job.elf << ": " << e.what() << std::endl;
+            job.result = 2;
+        }
+    } else
+        job.result = 127;
+    for (auto *p : plugin_list) delete p;
+    job.duration = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+    return job.result;
+}
+
+/**
+ * executes the jobs on a pool of worker threads. Only the interpreter is known to be reentrant, the
+ * TCC and LLVM backends share process wide compiler state. Hence jobs using them are serialized while
+ * interpreter jobs run in parallel to them.
+ */
+int run_batch(std::vector<batch_job>& jobs, unsigned workers){
+    std::atomic<size_t> next_job{0};
+    std::mutex jit_mtx;
+    auto worker = [&jobs, &next_job, &jit_mtx](){
+        core_cache cache;
+        for(auto idx = next_job++; idx<jobs.size(); idx = next_job++){
+            std::unique_lock<std::mutex> lock(jit_mtx, std::defer_lock);
+            if(jobs[idx].backend!="interp") lock.lock();
+            run_job(jobs[idx], cache);
+        }
+        // the JIT backends tear down process wide compiler state when their VMs are destroyed
+        std::lock_guard<std::mutex> lock(jit_mtx);
+        cache.clear();
+    };
+    if(workers<2)
+        worker();
+    else {
+        std::vector<std::thread> pool;
+        for(unsigned i=0; i<std::min<size_t>(workers, jobs.size()); ++i)
+            pool.emplace_back(worker);
+        for(auto& t:pool) t.join();
+    }
+    auto failed = 0U;
+    for(auto& job:jobs){
+        std::cout<<(job.result?"FAIL ":"PASS ")<<job.elf<<" ("<<job.isa<<"/"<<job.backend<<", exit code "<<job.result
+                <<", "<<job.icount<<" instructions in "<<job.duration<<"s)"<<std::endl;
+        if(job.result) ++failed;
+    }
+    std::cout<<jobs.size()-failed<<" of "<<jobs.size()<<" jobs passed"<<std::endl;
+    return failed?1:0;
 }
 
 int main(int argc, char *argv[]) {
@@ -83,11 +292,14 @@ int main(int argc, char *argv[]) {
         ("instructions,i", po::value<uint64_t>()->default_value(std::numeric_limits<uint64_t>::max()), "max. number of instructions to simulate")
         ("reset,r", po::value<std::string>(), "reset address")
         ("dump-ir", "dump the intermediate representation")
+        ("stats", "print runtime statistics at the end of the simulation")
         ("elf", po::value<std::vector<std::string>>(), "ELF file(s) to load")
         ("mem,m", po::value<std::string>(), "the memory input file")
         ("plugin,p", po::value<std::vector<std::string>>(), "plugin to activate")
         ("backend", po::value<std::string>()->default_value("tcc"), "the memory input file")
-        ("isa", po::value<std::string>()->default_value("rv32gc"), "isa to use for simulation");
+        ("isa", po::value<std::string>()->default_value("rv32gc"), "isa to use for simulation")
+        ("batch", po::value<std::string>(), "job file to execute, one ELF file with optional isa=, backend=, instructions=, reset= and plugin= settings per line")
+        ("jobs,j", po::value<unsigned>()->default_value(1), "number of worker threads executing the batch jobs, jobs using the tcc or llvm backend are executed one at a time");
     // clang-format on
     auto parsed = po::command_line_parser(argc, argv).options(desc).allow_unregistered().run();
     try {
@@ -127,48 +339,29 @@ int main(int argc, char *argv[]) {
         // application code comes here //
         iss::init_jit_debug(argc, argv);
 #endif
+        if (clim.count("batch")) {
+            batch_job dflt;
+            dflt.isa = clim["isa"].as<std::string>();
+            dflt.backend = clim["backend"].as<std::string>();
+            dflt.instructions = clim["instructions"].as<uint64_t>();
+            if (clim.count("reset")) dflt.reset = clim["reset"].as<std::string>();
+            if (clim.count("plugin")) dflt.plugins = clim["plugin"].as<std::vector<std::string>>();
+            auto jobs = read_job_file(clim["batch"].as<std::string>(), dflt);
+            return run_batch(jobs, clim["jobs"].as<unsigned>());
+        }
         bool dump = clim.count("dump-ir");
         // instantiate the simulator
         vm_ptr vm{nullptr};
         cpu_ptr cpu{nullptr};
+        icount_fn icount;
         std::string isa_opt(clim["isa"].as<std::string>());
-        if (isa_opt=="mnrv32") {
-            std::tie(cpu, vm) = create_cpu<iss::arch::mnrv32>(clim["backend"].as<std::string>(), clim["gdb-port"].as<unsigned>());
-        } else if (isa_opt=="rv64i") {
-            std::tie(cpu, vm) = create_cpu<iss::arch::rv64i>(clim["backend"].as<std::string>(), clim["gdb-port"].as<unsigned>());
-        } else if (isa_opt=="rv64gc") {
-            std::tie(cpu, vm) = create_cpu<iss::arch::rv64gc>(clim["backend"].as<std::string>(), clim["gdb-port"].as<unsigned>());
-        } else if (isa_opt=="rv32imac") {
-            std::tie(cpu, vm) = create_cpu<iss::arch::rv32imac>(clim["backend"].as<std::string>(), clim["gdb-port"].as<unsigned>());
-        } else if (isa_opt=="rv32gc") {
-            std::tie(cpu, vm) = create_cpu<iss::arch::rv32gc>(clim["backend"].as<std::string>(), clim["gdb-port"].as<unsigned>());
-        } else {
+        std::tie(cpu, vm, icount, std::ignore) = create_cpu(isa_opt, clim["backend"].as<std::string>(), clim["gdb-port"].as<unsigned>());
+        if (!vm) {
             LOG(ERROR) << "Illegal argument value for '--isa': " << clim["isa"].as<std::string>() << std::endl;
             return 127;
         }
-        if (clim.count("plugin")) {
-            for (std::string const& opt_val : clim["plugin"].as<std::vector<std::string>>()) {
-                std::string plugin_name=opt_val;
-                std::string filename{"cycles.txt"};
-                std::size_t found = opt_val.find('=');
-                if (found != std::string::npos) {
-                    plugin_name = opt_val.substr(0, found);
-                    filename = opt_val.substr(found + 1, opt_val.size());
-                }
-                if (plugin_name == "ic") {
-                    auto *ic_plugin = new iss::plugin::instruction_count(filename);
-                    vm->register_plugin(*ic_plugin);
-                    plugin_list.push_back(ic_plugin);
-                } else if (plugin_name == "ce") {
-                    auto *ce_plugin = new iss::plugin::cycle_estimate(filename);
-                    vm->register_plugin(*ce_plugin);
-                    plugin_list.push_back(ce_plugin);
-                } else {
-                    LOG(ERROR) << "Unknown plugin name: " << plugin_name << ", valid names are 'ce', 'ic'" << std::endl;
-                    return 127;
-                }
-            }
-        }
+        if (clim.count("plugin") && !register_plugins(*vm, clim["plugin"].as<std::vector<std::string>>(), plugin_list))
+            return 127;
         if (clim.count("disass")) {
             vm->setDisassEnabled(true);
             LOGGER(disass)::reporting_level() = logging::INFO;
@@ -191,13 +384,19 @@ int main(int argc, char *argv[]) {
             auto start_addr = vm->get_arch()->load_file(input); // treat remaining arguments as elf files
             if (start_addr.second) start_address = start_addr.first;
         }
-        if (clim.count("reset")) {
-            auto str = clim["reset"].as<std::string>();
-            start_address = str.find("0x") == 0 ? std::stoull(str.substr(2), nullptr, 16) : std::stoull(str, nullptr, 10);
-        }
+        if (clim.count("reset"))
+            start_address = parse_address(clim["reset"].as<std::string>());
         vm->reset(start_address);
         auto cycles = clim["instructions"].as<uint64_t>();
+        auto start = std::chrono::high_resolution_clock::now();
         res = vm->start(cycles, dump);
+        auto duration = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+        LOG(INFO) << "Executed " << icount() << " instructions in " << duration << "s ("
+                  << (duration > 0 ? icount() / duration / 1e6 : 0.0) << " MIPS)" << std::endl;
+        if (clim.count("stats")) {
+            auto stats = iss::get_statistics(*vm);
+            std::cout << stats << "execution time:          " << duration - stats.translation_ns / 1e9 << "s" << std::endl;
+        }
     } catch (std::exception &e) {
         LOG(ERROR) << "Unhandled Exception reached the top of main: " << e.what() << ", application will now exit"
                    << std::endl;
@@ -0,0 +1,226 @@
+/*******************************************************************************
+ * Copyright (C) 2017, 2018 MINRES Technologies GmbH
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ *******************************************************************************/
+
+
+#include "sysc/core_cluster.h"
+#include "iss/iss.h"
+#include <algorithm>
+
+namespace sysc {
+namespace SiFive {
+using namespace sc_core;
+
+core_cluster::core_cluster(sc_module_name name, unsigned num_cores)
+: sc_module(name)
+, cores("cores") {
+    SC_HAS_PROCESS(core_cluster);// NOLINT
+    cores.init(num_cores, [this](const char *nm, size_t idx) -> core_complex * {
+        auto *core = new core_complex(nm);
+        core->cluster = this;
+        return core;
+    });
+    SC_THREAD(run);
+}
+
+core_cluster::~core_cluster() {
+    // host threads still waiting for a quantum which never starts stop their core and terminate
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        shutdown = true;
+    }
+    cores_cv.notify_all();
+    for (auto &t : threads)
+        if (t.joinable()) t.join();
+}
+
+template <typename P>
+void core_cluster::wait_halted(std::unique_lock<std::mutex> &lock, core_complex &core, P pred) {
+    core.halted = true;
+    kernel_cv.notify_all();
+    cores_cv.wait(lock, [this, &pred]() { return shutdown || pred(); });
+    core.halted = false;
+    if (shutdown) core.stop_execution();
+}
+
+void core_cluster::execute(core_complex &core, std::function<void()> const &f) {
+    if (std::this_thread::get_id() == kernel_thread) {
+        f();
+        return;
+    }
+    std::unique_lock<std::mutex> lock(mtx);
+    request req{&f, false};
+    requests.push_back(&req);
+    wait_halted(lock, core, [&req]() { return req.done; });
+    auto it = std::find(requests.begin(), requests.end(), &req);
+    if (it != requests.end()) requests.erase(it);
+}
+
+void core_cluster::rendezvous(core_complex &core) {
+    std::unique_lock<std::mutex> lock(mtx);
+    auto quantum = quantum_cnt;
+    --running;
+    wait_halted(lock, core, [this, quantum]() { return quantum_cnt != quantum; });
+}
+
+void core_cluster::halt(core_complex &core) {
+    std::unique_lock<std::mutex> lock(mtx);
+    wait_halted(lock, core, [&core]() { return !core.halt_requested; });
+}
+
+void core_cluster::enter_atomic_section(core_complex &core) {
+    std::unique_lock<std::mutex> lock(mtx);
+    if (atomic_owner && atomic_owner != &core) wait_halted(lock, core, [this]() { return atomic_owner == nullptr; });
+    atomic_owner = &core;
+    serialize_stores = true;
+    lock.unlock();
+    // the memory accesses of the section must see the stores which started before they got serialized
+    while (unserialized_stores) std::this_thread::yield();
+}
+
+void core_cluster::leave_atomic_section(core_complex &core, bool reserved) {
+    std::lock_guard<std::mutex> lock(mtx);
+    if (core.reserving != reserved) {
+        core.reserving = reserved;
+        if (reserved)
+            ++reserving_cores;
+        else
+            --reserving_cores;
+    }
+    if (atomic_owner == &core) atomic_owner = nullptr;
+    serialize_stores = atomic_owner != nullptr || reserving_cores != 0;
+    cores_cv.notify_all();
+}
+
+bool core_cluster::enter_store(core_complex &core, uint64_t addr, unsigned length) {
+    std::unique_lock<std::mutex> lock(mtx);
+    auto started = atomic_owner != &core;
+    if (started) {
+        if (atomic_owner) wait_halted(lock, core, [this]() { return atomic_owner == nullptr; });
+        atomic_owner = &core;
+        serialize_stores = true;
+    }
+    // the reservations of a core are only modified by itself within its atomic section
+    for (auto &other : cores)
+        if (&other != &core && other.reserving && !other.break_reservation(addr, length)) {
+            other.reserving = false;
+            --reserving_cores;
+        }
+    return started;
+}
+
+void core_cluster::leave_store(core_complex &core) {
+    std::lock_guard<std::mutex> lock(mtx);
+    if (atomic_owner == &core) atomic_owner = nullptr;
+    serialize_stores = atomic_owner != nullptr || reserving_cores != 0;
+    cores_cv.notify_all();
+}
+
+void core_cluster::execute_core(core_complex &core) {
+    std::unique_lock<std::mutex> lock(mtx);
+    for (;;) {
+        wait_halted(lock, core, [&core]() { return !core.stopped; });
+        if (shutdown) break;
+        lock.unlock();
+        core.vm->start();
+#ifdef WITH_SCV
+        core.wait_instr_records();
+#endif
+        lock.lock();
+        core.stopped = true;
+        --running;
+        // the VM also returns upon reset and clock gating, the core is restarted at a quantum boundary then
+        if (!core.execution_interrupted()) break;
+    }
+    core.terminated = true;
+    core.halted = true;
+    --active;
+    kernel_cv.notify_all();
+}
+
+void core_cluster::start_cores() {
+    running = 0;
+    for (auto &core : cores) {
+        if (core.stopped && !core.terminated) core.stopped = !core.try_start_run();
+        if (!core.stopped) ++running;
+    }
+    cores_cv.notify_all();
+}
+
+void core_cluster::run() {
+    wait(SC_ZERO_TIME); // separate from elaboration phase
+    kernel_thread = std::this_thread::get_id();
+    active = cores.size();
+    for (auto &core : cores) threads.emplace_back([this, &core]() { execute_core(core); });
+    std::unique_lock<std::mutex> lock(mtx);
+    start_cores();
+    while (active) {
+        kernel_cv.wait(lock, [this]() { return running == 0 || !requests.empty(); });
+        while (!requests.empty()) {
+            auto *req = requests.front();
+            requests.pop_front();
+            lock.unlock();
+            {
+#ifdef WITH_SCV
+                // the requests of a core may record while the writer threads of the other cores are active
+                std::lock_guard<std::mutex> db_lock(core_complex::recording_mtx);
+#endif
+                (*req->fn)();
+            }
+            lock.lock();
+            req->done = true;
+            cores_cv.notify_all();
+        }
+        if (running || !active) continue;
+        // all cores reached the end of the quantum, let the rest of the platform catch up
+        lock.unlock();
+        sc_time local_time;
+        for (auto &core : cores) local_time = std::max(local_time, core.quantum_keeper.get_local_time());
+        wait(local_time == SC_ZERO_TIME ? tlm::tlm_global_quantum::instance().compute_local_quantum() : local_time);
+        lock.lock();
+        for (auto &core : cores) {
+            core.reset_quantum();
+            core.apply_deferred_updates();
+        }
+        ++quantum_cnt;
+        start_cores();
+    }
+    lock.unlock();
+    for (auto &t : threads) t.join();
+    threads.clear();
+#ifdef WITH_SCV
+    for (auto &core : cores) core.wait_instr_records();
+#endif
+    sc_stop();
+}
+
+} /* namespace SiFive */
+} /* namespace sysc */
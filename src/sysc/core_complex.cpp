@@ -31,17 +31,27 @@
  *******************************************************************************/
 
 #include "sysc/core_complex.h"
+#include "sysc/core_cluster.h"
 #include "iss/arch/riscv_hart_msu_vp.h"
-//#include "iss/arch/rv32imac.h"
 #include "iss/arch/mnrv32.h"
+#include "iss/arch/rv32gc.h"
+#include "iss/arch/rv32imac.h"
+#include "iss/arch/rv64gc.h"
+#include "iss/arch/rv64i.h"
 #include "iss/debugger/encoderdecoder.h"
 #include "iss/debugger/gdb_session.h"
 #include "iss/debugger/server.h"
 #include "iss/debugger/target_adapter_if.h"
 #include "iss/iss.h"
+#include "iss/statistics.h"
 #include "iss/vm_types.h"
 #include "scc/report.h"
+#ifdef WITH_LLVM
+#include "iss/llvm/jit_helper.h"
+#endif
+#include <algorithm>
 #include <sstream>
+#include <tuple>
 #include <iostream>
 
 #ifdef WITH_SCV
@@ -60,9 +70,6 @@ namespace {
 iss::debugger::encoder_decoder encdec;
 }
 
-//using core_type = iss::arch::rv32imac;
-using core_type = iss::arch::mnrv32;
-
 namespace {
 
 std::array<const char, 4> lvl = {{'U', 'S', 'H', 'M'}};
@@ -91,34 +98,111 @@ std::array<const char*, 12> irq_str = { {
 		"User external interrupt", "Supervisor external interrupt", "Reserved", "Machine external interrupt" } };
 }
 
-class core_wrapper : public iss::arch::riscv_hart_msu_vp<core_type> {
+/**
+ * the interface of the core towards core_complex, independent of the instantiated core type
+ */
+class core_wrapper {
+public:
+    virtual ~core_wrapper() = default;
+
+    virtual iss::arch_if *get_arch() = 0;
+
+    virtual uint32_t get_mode() = 0;
+
+    virtual uint64_t get_mstatus() = 0;
+
+    virtual uint64_t get_cycle() const = 0;
+
+    virtual void set_interrupt_execution(bool v) = 0;
+
+    virtual bool get_interrupt_execution() = 0;
+
+    virtual void process_events() = 0;
+
+    virtual void local_irq(short id, bool value) = 0;
+    /**
+     * drop the code translated from the physical address range [start, end] as the memory backing it
+     * may change without the core noticing. It may be called from within a block (e.g. during a b_transport
+     * of the core), hence the code is only queued for invalidation and dropped at the next block boundary
+     */
+    virtual void invalidate_code(uint64_t start, uint64_t end) = 0;
+    /**
+     * have the events processed at the next block boundary, may be called from any thread
+     */
+    virtual void schedule_events() = 0;
+    /**
+     * drop the code translated from the physical address range [start, end) at the next block boundary, may be
+     * called from any thread
+     */
+    virtual void request_code_invalidation(uint64_t start, uint64_t end) = 0;
+    /**
+     * drop the reservations of LR instructions overlapping a store of another core
+     *
+     * @return true if the core still holds a reservation
+     */
+    virtual bool break_reservation(uint64_t addr, unsigned length) = 0;
+    /**
+     * @return true if a trap or an interrupt request ends a wait for interrupt
+     */
+    virtual bool wakeup_pending() = 0;
+};
+
+template <typename CORE> class core_wrapper_t : public core_wrapper, public iss::arch::riscv_hart_msu_vp<CORE> {
 public:
-    using base_type = arch::riscv_hart_msu_vp<core_type>;
-    using phys_addr_t = typename arch::traits<core_type>::phys_addr_t;
-    core_wrapper(core_complex *owner)
-    : owner(owner) 
+    using base_type = arch::riscv_hart_msu_vp<CORE>;
+    using reg_t = typename base_type::reg_t;
+    using phys_addr_t = typename arch::traits<CORE>::phys_addr_t;
+    core_wrapper_t(core_complex *owner)
+    : owner(owner)
     {
     }
 
-    uint32_t get_mode() { return this->reg.machine_state; }
+    iss::arch_if *get_arch() override { return this; }
+
+    uint32_t get_mode() override { return this->reg.machine_state; }
+
+    uint64_t get_mstatus() override { return static_cast<reg_t>(this->state.mstatus); }
+
+    inline uint64_t get_cycle() const override { return this->reg.icount + this->cycle_offset; }
+
+    inline void set_interrupt_execution(bool v) override { this->interrupt_sim = v?1:0; }
+
+    inline bool get_interrupt_execution() override { return this->interrupt_sim; }
 
-    inline void set_interrupt_execution(bool v) { this->interrupt_sim = v?1:0; }
+    void process_events() override {
+        // called by the VM at a block boundary once icount reaches next_event_icount, which also covers the
+        // end of the current quantum
+        owner->sync(get_cycle());
+        base_type::process_events();
+        auto sync_cycle = owner->next_sync_cycle();
+        this->next_event_icount =
+            std::min(this->next_event_icount, sync_cycle - std::min(sync_cycle, this->cycle_offset));
+    }
+
+    void invalidate_code(uint64_t start, uint64_t end) override { this->invalidate_code_pages(start, end); }
 
-    inline bool get_interrupt_execution() { return this->interrupt_sim; }
+    void schedule_events() override { this->async_event = true; }
 
-    base_type::hart_state<base_type::reg_t> &get_state() { return this->state; }
+    void request_code_invalidation(uint64_t start, uint64_t end) override {
+        base_type::request_code_invalidation(start, end);
+    }
 
-    void notify_phase(exec_phase p) override {
-        if (p == ISTART) owner->sync(this->reg.icount + cycle_offset);
+    bool break_reservation(uint64_t addr, unsigned length) override {
+        return base_type::break_reservation(addr, length);
     }
 
-    sync_type needed_sync() const override { return PRE_SYNC; }
+    bool wakeup_pending() override { return this->reg.pending_trap != 0 || this->interrupt_sim; }
+
+    void enter_atomic_section() override { owner->enter_atomic_section(); }
+
+    void leave_atomic_section() override { owner->leave_atomic_section(!this->atomic_reservation.empty()); }
 
     void disass_output(uint64_t pc, const std::string instr) override {
         if (INFO <= Log<Output2FILE<disass>>::reporting_level() && Output2FILE<disass>::stream()) {
             std::stringstream s;
             s << "[p:" << lvl[this->reg.machine_state] << ";s:0x" << std::hex << std::setfill('0')
-              << std::setw(sizeof(reg_t) * 2) << (reg_t)state.mstatus << std::dec << ";c:" << this->reg.icount << "]";
+              << std::setw(sizeof(reg_t) * 2) << (reg_t)this->state.mstatus << std::dec << ";c:" << this->reg.icount
+              << "]";
             Log<Output2FILE<disass>>().get(INFO, "disass")
                 << "0x" << std::setw(16) << std::right << std::setfill('0') << std::hex << pc << "\t\t" << std::setw(40)
                 << std::setfill(' ') << std::left << instr << s.str();
@@ -152,7 +236,7 @@ public:
     status read_csr(unsigned addr, reg_t &val) override {
         if((addr==arch::time || addr==arch::timeh) && owner->mtime_o.get_interface(0)){
             uint64_t time_val;
-            bool ret = owner->mtime_o->nb_peek(time_val);
+            bool ret = owner->read_mtime(get_cycle(), time_val);
             if (addr == iss::arch::time) {
                 val = static_cast<reg_t>(time_val);
             } else if (addr == iss::arch::timeh) {
@@ -167,14 +251,16 @@ public:
 
     void wait_until(uint64_t flags) override {
         SCCDEBUG(owner->name()) << "Sleeping until interrupt";
-        do {
-            wait(wfi_evt);
-        } while (this->reg.pending_trap == 0);
+        owner->sync(get_cycle());
+        // account the slept time so that the cycle and time counters follow the SystemC time
+        while (this->reg.pending_trap == 0 && !this->interrupt_sim)
+            this->cycle_offset += owner->wait_for_interrupt(wfi_evt);
+        this->reschedule_events(); // reschedule the timer and synchronization events after the time skip
         base_type::wait_until(flags);
     }
 
-    void local_irq(short id, bool value) {
-        base_type::reg_t mask = 0;
+    void local_irq(short id, bool value) override {
+        reg_t mask = 0;
         switch (id) {
         case 16: // SW
             mask = 1 << 3;
@@ -202,6 +288,29 @@ private:
     sc_event wfi_evt;
 };
 
+template <typename CORE>
+std::pair<std::unique_ptr<core_wrapper>, std::unique_ptr<vm_if>>
+create_cpu(core_complex *owner, std::string const &backend, unsigned short port, bool dump) {
+    auto *lcpu = new core_wrapper_t<CORE>(owner);
+    std::unique_ptr<core_wrapper> cpu{lcpu};
+    if (backend == "interp") return {std::move(cpu), interp::create<CORE>(lcpu, port, dump)};
+#ifdef WITH_LLVM
+    if (backend == "llvm") return {std::move(cpu), llvm::create<CORE>(lcpu, port, dump)};
+#endif
+    if (backend == "tcc") return {std::move(cpu), tcc::create<CORE>(lcpu, port, dump)};
+    return {nullptr, nullptr};
+}
+
+std::pair<std::unique_ptr<core_wrapper>, std::unique_ptr<vm_if>>
+create_cpu(core_complex *owner, std::string const &isa, std::string const &backend, unsigned short port, bool dump) {
+    if (isa == "mnrv32") return create_cpu<arch::mnrv32>(owner, backend, port, dump);
+    if (isa == "rv32imac") return create_cpu<arch::rv32imac>(owner, backend, port, dump);
+    if (isa == "rv32gc") return create_cpu<arch::rv32gc>(owner, backend, port, dump);
+    if (isa == "rv64i") return create_cpu<arch::rv64i>(owner, backend, port, dump);
+    if (isa == "rv64gc") return create_cpu<arch::rv64gc>(owner, backend, port, dump);
+    return {nullptr, nullptr};
+}
+
 int cmd_sysc(int argc, char *argv[], debugger::out_func of, debugger::data_func df,
              debugger::target_adapter_if *tgt_adapter) {
     if (argc > 1) {
@@ -232,6 +341,8 @@ int cmd_sysc(int argc, char *argv[], debugger::out_func of, debugger::data_func
     return Err;
 }
 
+std::vector<core_complex *> core_complex::all_cores;
+
 core_complex::core_complex(sc_module_name name)
 : sc_module(name)
 , NAMED(initiator)
@@ -245,6 +356,10 @@ core_complex::core_complex(sc_module_name name)
 , NAMED(reset_address, 0ULL)
 , NAMED(gdb_server_port, 0)
 , NAMED(dump_ir, false)
+, NAMED(backend, "interp")
+, NAMED(core_type, "mnrv32")
+, NAMED(fetch_buffer_size, 0U)
+, NAMED(mtime_period, SC_ZERO_TIME)
 , read_lut(tlm_dmi_ext())
 , write_lut(tlm_dmi_ext())
 , tgt_adapter(nullptr)
@@ -256,15 +371,13 @@ core_complex::core_complex(sc_module_name name)
 #endif
 {
     SC_HAS_PROCESS(core_complex);// NOLINT
+    all_cores.push_back(this);
     initiator.register_invalidate_direct_mem_ptr([=](uint64_t start, uint64_t end) -> void {
-        auto lut_entry = read_lut.getEntry(start);
-        if (lut_entry.get_granted_access() != tlm::tlm_dmi::DMI_ACCESS_NONE && end <= lut_entry.get_end_address() + 1) {
-            read_lut.removeEntry(lut_entry);
-        }
-        lut_entry = write_lut.getEntry(start);
-        if (lut_entry.get_granted_access() != tlm::tlm_dmi::DMI_ACCESS_NONE && end <= lut_entry.get_end_address() + 1) {
-            write_lut.removeEntry(lut_entry);
-        }
+        if (!cluster)
+            invalidate_dmi(start, end);
+        else
+            // the DMI pointers must not be used anymore once the call returns, hence the core is halted
+            cluster->execute_halted(*this, [=]() { invalidate_dmi(start, end); });
     });
 
     SC_THREAD(run);
@@ -280,14 +393,35 @@ core_complex::core_complex(sc_module_name name)
     sensitive << global_irq_i;
 }
 
-core_complex::~core_complex() = default;
+core_complex::~core_complex() {
+    all_cores.erase(std::remove(all_cores.begin(), all_cores.end(), this), all_cores.end());
+#ifdef WITH_SCV
+    if (instr_writer.joinable()) {
+        {
+            std::lock_guard<std::mutex> lock(instr_mtx);
+            instr_writer_stop = true;
+        }
+        instr_cv.notify_all();
+        instr_writer.join();
+    }
+#endif
+}
 
 void core_complex::trace(sc_trace_file *trf) const {}
 
 void core_complex::before_end_of_elaboration() {
-    cpu = scc::make_unique<core_wrapper>(this);
-    //vm = tcc::create<core_type>(cpu.get(), gdb_server_port.get_value(), dump_ir.get_value());
-    vm = interp::create<core_type>(cpu.get(), gdb_server_port.get_value(), dump_ir.get_value());
+    if (cluster && backend.get_value() != "interp") {
+        // the JIT backends share process wide compiler state which is not reentrant, see run_batch of riscv-sim
+        SC_REPORT_FATAL(name(), ("backend " + backend.get_value() + " cannot run in a core cluster").c_str());
+        return;
+    }
+    std::tie(cpu, vm) = create_cpu(this, core_type.get_value(), backend.get_value(), gdb_server_port.get_value(),
+                                   dump_ir.get_value());
+    if (!vm) {
+        SC_REPORT_FATAL(name(), ("illegal core_type/backend combination " + core_type.get_value() + "/" +
+                                 backend.get_value()).c_str());
+        return;
+    }
 #ifdef WITH_SCV
     vm->setDisassEnabled(enable_disass.get_value() || m_db != nullptr);
 #else
@@ -304,11 +438,15 @@ void core_complex::before_end_of_elaboration() {
 
 void core_complex::start_of_simulation() {
     quantum_keeper.reset();
+    auto line_size = fetch_buffer_size.get_value();
+    if (line_size & (line_size - 1)) SC_REPORT_FATAL(name(), "fetch_buffer_size needs to be a power of 2");
+    fetch_buf.resize(line_size);
+    fetch_buf_len = 0;
     if (elf_file.get_value().size() > 0) {
         istringstream is(elf_file.get_value());
         string s;
         while (getline(is, s, ',')) {
-            std::pair<uint64_t, bool> start_addr = cpu->load_file(s);
+            std::pair<uint64_t, bool> start_addr = cpu->get_arch()->load_file(s);
             if (reset_address.is_default_value() && start_addr.second == true)
                 reset_address.set_value(start_addr.first);
         }
@@ -319,6 +457,8 @@ void core_complex::start_of_simulation() {
         stream_handle = new scv_tr_stream((basename + ".instr").c_str(), "TRANSACTOR", m_db);
         instr_tr_handle = new scv_tr_generator<>("execute", *stream_handle);
         fetch_tr_handle = new scv_tr_generator<uint64_t>("fetch", *stream_handle);
+        instr_records.resize(max_instr_records);
+        instr_writer = std::thread([this]() { write_instr_records(); });
     }
 #endif
 }
@@ -326,148 +466,479 @@ void core_complex::start_of_simulation() {
 void core_complex::disass_output(uint64_t pc, const std::string instr_str) {
 #ifdef WITH_SCV
     if (m_db == nullptr) return;
-    if (tr_handle.is_active()) tr_handle.end_transaction();
-    tr_handle = instr_tr_handle->begin_transaction();
-    tr_handle.record_attribute("PC", pc);
-    tr_handle.record_attribute("INSTR", instr_str);
-    tr_handle.record_attribute("MODE", lvl[cpu->get_mode()]);
-    tr_handle.record_attribute("MSTATUS", cpu->get_state().mstatus.st.value);
-    tr_handle.record_attribute("LTIME_START", quantum_keeper.get_current_time().value() / 1000);
+    // the text of an address only changes if the code gets modified, the queued records keep the old one
+    auto it = instr_texts.find(pc);
+    if (it == instr_texts.end() || *it->second != instr_str) {
+        if (instr_texts.size() >= max_instr_texts) instr_texts.clear();
+        auto &text = instr_texts[pc];
+        text = std::make_shared<const std::string>(instr_str);
+        it = instr_texts.find(pc);
+    }
+    auto &rec = instr_records[instr_record_cnt++];
+    rec.pc = pc;
+    rec.cycle = cpu->get_cycle();
+    rec.mstatus = cpu->get_mstatus();
+    rec.mode = cpu->get_mode();
+    rec.text = it->second;
+    if (instr_record_cnt == instr_records.size()) flush_instr_records();
 #endif
 }
 
+#ifdef WITH_SCV
+std::mutex core_complex::recording_mtx;
+
+void core_complex::flush_instr_records() {
+    std::unique_lock<std::mutex> lock(instr_mtx);
+    // the core only waits if the writer thread falls behind by more than max_instr_batches batches
+    instr_cv.wait(lock, [this]() { return instr_queue.size() < max_instr_batches; });
+    instr_queue.push_back(instr_batch{std::move(instr_records), instr_record_cnt, quantum_keeper.get_current_time(),
+                                      last_sync_cycle, curr_clk});
+    instr_record_cnt = 0;
+    if (instr_free.empty())
+        instr_records.resize(max_instr_records);
+    else {
+        instr_records = std::move(instr_free.back());
+        instr_free.pop_back();
+    }
+    instr_cv.notify_all();
+}
+
+void core_complex::wait_instr_records() {
+    if (m_db == nullptr) return;
+    if (instr_record_cnt) flush_instr_records();
+    std::unique_lock<std::mutex> lock(instr_mtx);
+    instr_cv.wait(lock, [this]() { return instr_queue.empty(); });
+}
+
+void core_complex::write_instr_records() {
+    std::unique_lock<std::mutex> lock(instr_mtx);
+    while (true) {
+        instr_cv.wait(lock, [this]() { return instr_writer_stop || !instr_queue.empty(); });
+        if (instr_queue.empty()) return;
+        // the batch stays queued while being recorded so that wait_instr_records also waits for it
+        auto &batch = instr_queue.front();
+        lock.unlock();
+        {
+            std::lock_guard<std::mutex> db_lock(recording_mtx);
+            record_instructions(batch);
+        }
+        lock.lock();
+        for (size_t i = 0; i < batch.cnt; ++i) batch.records[i].text.reset();
+        instr_free.push_back(std::move(batch.records));
+        instr_queue.pop_front();
+        instr_cv.notify_all();
+    }
+}
+
+void core_complex::record_instructions(instr_batch const &batch) {
+    for (size_t i = 0; i < batch.cnt; ++i) {
+        auto &rec = batch.records[i];
+        // the local time of the instruction relative to the time of the last sync
+        auto ltime = rec.cycle >= batch.sync_cycle
+                         ? batch.sync_time + batch.clk * static_cast<double>(rec.cycle - batch.sync_cycle)
+                         : batch.sync_time - batch.clk * static_cast<double>(batch.sync_cycle - rec.cycle);
+        if (tr_handle.is_active()) tr_handle.end_transaction();
+        tr_handle = instr_tr_handle->begin_transaction();
+        tr_handle.record_attribute("PC", rec.pc);
+        tr_handle.record_attribute("INSTR", *rec.text);
+        tr_handle.record_attribute("MODE", lvl[rec.mode]);
+        tr_handle.record_attribute("MSTATUS", rec.mstatus);
+        tr_handle.record_attribute("LTIME_START", ltime.value() / 1000);
+    }
+}
+#endif
+
+iss::statistics core_complex::get_statistics() const { return iss::get_statistics(*vm); }
+
 void core_complex::clk_cb() {
+    if (!cluster)
+        update_clk();
+    else if (!cluster->when_halted(*this, [this]() { update_clk(); }))
+        // the core runs on its host thread, the change is applied at the next quantum boundary
+        deferred_clk = true;
+}
+
+void core_complex::update_clk() {
     curr_clk = clk_i.read();
     if (curr_clk == SC_ZERO_TIME) cpu->set_interrupt_execution(true);
 }
 
 void core_complex::rst_cb() {
-    if (rst_i.read()) cpu->set_interrupt_execution(true);
+    if (!rst_i.read()) return;
+    if (!cluster)
+        cpu->set_interrupt_execution(true);
+    else if (!cluster->when_halted(*this, [this]() { cpu->set_interrupt_execution(true); }))
+        deferred_stop = true;
+}
+
+void core_complex::stop_execution() { cpu->set_interrupt_execution(true); }
+
+void core_complex::sw_irq_cb() { set_irq(16, sw_irq_i.read()); }
+
+void core_complex::timer_irq_cb() { set_irq(17, timer_irq_i.read()); }
+
+void core_complex::global_irq_cb() { set_irq(18, global_irq_i.read()); }
+
+void core_complex::set_irq(short id, bool value) {
+    if (!cluster)
+        cpu->local_irq(id, value);
+    else if (!cluster->when_halted(*this, [=]() { cpu->local_irq(id, value); }))
+        // the core runs on its host thread, the change is applied at the next quantum boundary
+        deferred_irqs.emplace_back(id, value);
+}
+
+void core_complex::invalidate_dmi(uint64_t start, uint64_t end) {
+    fetch_mru = tlm_dmi_ext();
+    fetch_buf_len = 0;
+    read_mru = tlm_dmi_ext();
+    write_mru = tlm_dmi_ext();
+    auto lut_entry = read_lut.getEntry(start);
+    if (lut_entry.get_granted_access() != tlm::tlm_dmi::DMI_ACCESS_NONE && end <= lut_entry.get_end_address() + 1) {
+        read_lut.removeEntry(lut_entry);
+    }
+    lut_entry = write_lut.getEntry(start);
+    if (lut_entry.get_granted_access() != tlm::tlm_dmi::DMI_ACCESS_NONE && end <= lut_entry.get_end_address() + 1) {
+        write_lut.removeEntry(lut_entry);
+    }
+    // the memory may be modified by others now, so code translated from it cannot be trusted anymore. This may
+    // happen during a transaction of the core itself, the core drops the code once the current block is left
+    if (cpu) cpu->invalidate_code(start, end);
+}
+
+void core_complex::apply_deferred_updates() {
+    for (auto &irq : deferred_irqs) cpu->local_irq(irq.first, irq.second);
+    deferred_irqs.clear();
+    if (deferred_clk) update_clk();
+    if (deferred_stop) cpu->set_interrupt_execution(true);
+    deferred_clk = deferred_stop = false;
+}
+
+void core_complex::request_halt() {
+    halt_requested = true;
+    cpu->schedule_events(); // a core not accessing memory halts at the next block boundary
+}
+
+void core_complex::halt_on_request() { cluster->halt(*this); }
+
+bool core_complex::break_reservation(uint64_t addr, unsigned length) { return cpu->break_reservation(addr, length); }
+
+void core_complex::enter_atomic_section() {
+    if (!cluster) return;
+    cluster->enter_atomic_section(*this);
+    in_atomic_section = true;
 }
 
-void core_complex::sw_irq_cb() { cpu->local_irq(16, sw_irq_i.read()); }
+void core_complex::leave_atomic_section(bool reserved) {
+    if (!cluster) return;
+    in_atomic_section = false;
+    cluster->leave_atomic_section(*this, reserved);
+}
 
-void core_complex::timer_irq_cb() { cpu->local_irq(17, timer_irq_i.read()); }
+void core_complex::reset_quantum() {
+    quantum_keeper.reset();
+    fetch_buf_len = 0; // other bus masters may have modified the buffered line while SystemC advanced
+    quantum_start = sc_time_stamp();
+    quantum_end = quantum_start + tlm::tlm_global_quantum::instance().compute_local_quantum();
+}
 
-void core_complex::global_irq_cb() { cpu->local_irq(18, global_irq_i.read()); }
+uint64_t core_complex::compute_sync_limit(uint64_t cycle) const {
+    if (curr_clk == SC_ZERO_TIME) return cycle + 1;
+    auto sync_point =
+        cluster ? quantum_end : sc_time_stamp() + tlm::tlm_global_quantum::instance().compute_local_quantum();
+    auto curr_time = current_time();
+    if (sync_point <= curr_time) return cycle + 1;
+    return cycle + static_cast<uint64_t>((sync_point - curr_time) / curr_clk) + 1;
+}
 
 void core_complex::run() {
+    if (cluster) return; // the cluster executes the core on a host thread
     wait(SC_ZERO_TIME); // separate from elaboration phase
     do {
-        if (rst_i.read()) {
-            cpu->reset(reset_address.get_value());
-            wait(rst_i.negedge_event());
-        }
-        while (clk_i.read() == SC_ZERO_TIME) {
-            wait(clk_i.value_changed_event());
-        }
-        cpu->set_interrupt_execution(false);
+        prepare_run();
         vm->start();
     } while (cpu->get_interrupt_execution());
+#ifdef WITH_SCV
+    wait_instr_records();
+#endif
     sc_stop();
 }
 
+void core_complex::prepare_run() {
+    if (rst_i.read()) {
+        cpu->get_arch()->reset(reset_address.get_value());
+        wait(rst_i.negedge_event());
+    }
+    while (clk_i.read() == SC_ZERO_TIME) {
+        wait(clk_i.value_changed_event());
+    }
+    start_run();
+}
+
+bool core_complex::try_start_run() {
+    if (rst_i.read()) {
+        cpu->get_arch()->reset(reset_address.get_value());
+        return false;
+    }
+    if (clk_i.read() == SC_ZERO_TIME) return false;
+    start_run();
+    return true;
+}
+
+void core_complex::start_run() {
+    cpu->set_interrupt_execution(false);
+    reset_quantum();
+    cpu->process_events(); // schedule the first synchronization point
+}
+
+bool core_complex::execution_interrupted() { return cpu->get_interrupt_execution(); }
+
+void core_complex::end_quantum() {
+#ifdef WITH_SCV
+    wait_instr_records(); // the rest of the platform records while the core waits
+#endif
+    if (cluster)
+        cluster->rendezvous(*this); // the cluster resets the quantum keeper
+    else {
+        wait(quantum_keeper.get_local_time());
+        quantum_keeper.reset();
+        fetch_buf_len = 0; // other bus masters may have modified the buffered line while SystemC advanced
+    }
+}
+
+bool core_complex::read_mtime(uint64_t cycle, uint64_t &val) {
+    // the timer only changes if the SystemC time advances, hence it is peeked once per time step
+    auto now = cluster ? quantum_start : sc_time_stamp();
+    if (!mtime_valid || mtime_stamp != now) {
+        bool ret = false;
+        if (cluster)
+            cluster->execute(*this, [this, &ret]() { ret = mtime_o->nb_peek(mtime_val); });
+        else
+            ret = mtime_o->nb_peek(mtime_val);
+        if (!ret) return false;
+        mtime_stamp = now;
+        mtime_valid = true;
+    }
+    val = mtime_val;
+    if (mtime_period.get_value() != SC_ZERO_TIME) {
+        auto local_time = quantum_keeper.get_local_time();
+        if (cycle > last_sync_cycle) local_time += curr_clk * static_cast<double>(cycle - last_sync_cycle);
+        val += static_cast<uint64_t>(local_time / mtime_period.get_value());
+    }
+    return true;
+}
+
+uint64_t core_complex::wait_for_interrupt(sc_event &evt) {
+#ifdef WITH_SCV
+    wait_instr_records();
+#endif
+    auto start = current_time();
+    if (cluster)
+        cluster->rendezvous(*this); // interrupts are applied at quantum boundaries
+    else {
+        // bring the SystemC time up to the local time so that the idle period is skipped in one step
+        if (quantum_keeper.get_local_time() != SC_ZERO_TIME) wait(quantum_keeper.get_local_time());
+        // an interrupt raised during the timed wait has already notified the event
+        if (!cpu->wakeup_pending()) wait(evt);
+        quantum_keeper.reset();
+        fetch_buf_len = 0;
+    }
+    auto now = current_time();
+    if (now <= start || curr_clk == SC_ZERO_TIME) return 0;
+    auto cycles = static_cast<uint64_t>((now - start) / curr_clk);
+    last_sync_cycle += cycles;
+    sync_limit_cycle = compute_sync_limit(last_sync_cycle);
+    return cycles;
+}
+
 bool core_complex::read_mem(uint64_t addr, unsigned length, uint8_t *const data, bool is_fetch) {
-    auto lut_entry = read_lut.getEntry(addr);
-    if (lut_entry.get_granted_access() != tlm::tlm_dmi::DMI_ACCESS_NONE &&
-        addr + length <= lut_entry.get_end_address() + 1) {
+    if (halt_requested) halt_on_request(); // the DMI regions are about to be invalidated
+    if (is_fetch && all_cores.size() > 1) track_fetch_page(addr);
+    auto &lut_entry = get_dmi_entry(read_lut, is_fetch ? fetch_mru : read_mru, addr, length);
+    if (lut_entry.get_granted_access() != tlm::tlm_dmi::DMI_ACCESS_NONE) {
         auto offset = addr - lut_entry.get_start_address();
         std::copy(lut_entry.get_dmi_ptr() + offset, lut_entry.get_dmi_ptr() + offset + length, data);
-        quantum_keeper.inc(lut_entry.get_read_latency());
+        if (lut_entry.get_read_latency() != SC_ZERO_TIME) quantum_keeper.inc(lut_entry.get_read_latency());
         return true;
-    } else {
-        tlm::tlm_generic_payload gp;
-        gp.set_command(tlm::TLM_READ_COMMAND);
-        gp.set_address(addr);
-        gp.set_data_ptr(data);
-        gp.set_data_length(length);
-        gp.set_streaming_width(length);
-        sc_time delay{quantum_keeper.get_local_time()};
-#ifdef WITH_SCV
-        if (m_db != nullptr && tr_handle.is_valid()) {
-            if (is_fetch && tr_handle.is_active()) {
-                tr_handle.end_transaction();
-            }
-            auto preExt = new scv4tlm::tlm_recording_extension(tr_handle, this);
-            gp.set_extension(preExt);
+    } else if (is_fetch && fetch_buf.size()) {
+        if (fetch_buf_stale.load(std::memory_order_relaxed) && fetch_buf_stale.exchange(false)) fetch_buf_len = 0;
+        if (addr < fetch_buf_addr || addr + length > fetch_buf_addr + fetch_buf_len) {
+            fetch_buf_len = 0;
+            auto line_addr = addr & ~static_cast<uint64_t>(fetch_buf.size() - 1);
+            // fetches crossing a line boundary or from memory not allowing line reads bypass the buffer
+            if (addr + length > line_addr + fetch_buf.size() ||
+                !read_bus(line_addr, fetch_buf.size(), fetch_buf.data(), true))
+                return read_bus(addr, length, data, true);
+            fetch_buf_addr = line_addr;
+            fetch_buf_len = fetch_buf.size();
         }
+        auto offset = addr - fetch_buf_addr;
+        std::copy(fetch_buf.data() + offset, fetch_buf.data() + offset + length, data);
+        return true;
+    } else
+        return read_bus(addr, length, data, is_fetch);
+}
+
+bool core_complex::read_bus(uint64_t addr, unsigned length, uint8_t *const data, bool is_fetch) {
+    sync(cpu->get_cycle()); // bring the local time up to date before leaving DMI
+#ifdef WITH_SCV
+    wait_instr_records();
 #endif
-        initiator->b_transport(gp, delay);
-        SCCTRACE(this->name()) << "read_mem(0x" << std::hex << addr << ") : " << data;
-        if (gp.get_response_status() != tlm::TLM_OK_RESPONSE) {
-            return false;
+    if (cluster) {
+        bool res = false;
+        cluster->execute(*this, [&]() { res = transport_read(addr, length, data, is_fetch); });
+        return res;
+    }
+    return transport_read(addr, length, data, is_fetch);
+}
+
+bool core_complex::transport_read(uint64_t addr, unsigned length, uint8_t *const data, bool is_fetch) {
+    auto gp_ptr = payload_pool.allocate();
+    auto &gp = *gp_ptr;
+    gp.set_command(tlm::TLM_READ_COMMAND);
+    gp.set_address(addr);
+    gp.set_data_ptr(data);
+    gp.set_data_length(length);
+    gp.set_streaming_width(length);
+    sc_time delay{quantum_keeper.get_local_time()};
+#ifdef WITH_SCV
+    if (m_db != nullptr && tr_handle.is_valid()) {
+        if (is_fetch && tr_handle.is_active()) {
+            tr_handle.end_transaction();
         }
-        if (gp.is_dmi_allowed()) {
-            gp.set_command(tlm::TLM_READ_COMMAND);
-            gp.set_address(addr);
-            tlm_dmi_ext dmi_data;
-            if (initiator->get_direct_mem_ptr(gp, dmi_data)) {
-                if (dmi_data.is_read_allowed())
-                    read_lut.addEntry(dmi_data, dmi_data.get_start_address(),
-                                      dmi_data.get_end_address() - dmi_data.get_start_address() + 1);
-                if (dmi_data.is_write_allowed())
-                    write_lut.addEntry(dmi_data, dmi_data.get_start_address(),
-                                       dmi_data.get_end_address() - dmi_data.get_start_address() + 1);
-            }
+        auto preExt = new scv4tlm::tlm_recording_extension(tr_handle, this);
+        gp.set_auto_extension(preExt);
+    }
+#endif
+    initiator->b_transport(gp, delay);
+    SCCTRACE(this->name()) << "read_mem(0x" << std::hex << addr << ") : " << data;
+    if (gp.get_response_status() != tlm::TLM_OK_RESPONSE) {
+        return false;
+    }
+    if (gp.is_dmi_allowed()) {
+        gp.set_command(tlm::TLM_READ_COMMAND);
+        gp.set_address(addr);
+        tlm_dmi_ext dmi_data;
+        if (initiator->get_direct_mem_ptr(gp, dmi_data)) {
+            if (dmi_data.is_read_allowed())
+                read_lut.addEntry(dmi_data, dmi_data.get_start_address(),
+                                  dmi_data.get_end_address() - dmi_data.get_start_address() + 1);
+            if (dmi_data.is_write_allowed())
+                write_lut.addEntry(dmi_data, dmi_data.get_start_address(),
+                                   dmi_data.get_end_address() - dmi_data.get_start_address() + 1);
         }
-        return true;
     }
+    return true;
 }
 
 bool core_complex::write_mem(uint64_t addr, unsigned length, const uint8_t *const data) {
-    auto lut_entry = write_lut.getEntry(addr);
-    if (lut_entry.get_granted_access() != tlm::tlm_dmi::DMI_ACCESS_NONE &&
-        addr + length <= lut_entry.get_end_address() + 1) {
-        auto offset = addr - lut_entry.get_start_address();
-        std::copy(data, data + length, lut_entry.get_dmi_ptr() + offset);
-        quantum_keeper.inc(lut_entry.get_read_latency());
-        return true;
-    } else {
-        write_buf.resize(length);
-        std::copy(data, data + length, write_buf.begin()); // need to copy as TLM does not guarantee data integrity
-        tlm::tlm_generic_payload gp;
-        gp.set_command(tlm::TLM_WRITE_COMMAND);
-        gp.set_address(addr);
-        gp.set_data_ptr(write_buf.data());
-        gp.set_data_length(length);
-        gp.set_streaming_width(length);
-        sc_time delay{quantum_keeper.get_local_time()};
-#ifdef WITH_SCV
-        if (m_db != nullptr && tr_handle.is_valid()) {
-            auto preExt = new scv4tlm::tlm_recording_extension(tr_handle, this);
-            gp.set_extension(preExt);
+    if (halt_requested) halt_on_request(); // the DMI regions are about to be invalidated
+    invalidate_fetch_buf(addr, length);
+    auto res = cluster ? write_cluster_mem(addr, length, data)
+                       : write_dmi(addr, length, data) || write_bus(addr, length, data);
+    if (res && all_cores.size() > 1) notify_store(addr, length);
+    return res;
+}
+
+void core_complex::notify_store(uint64_t addr, unsigned length) {
+    auto first = addr >> code_page_shift, last = (addr + length - 1) >> code_page_shift;
+    for (auto *other : all_cores) {
+        if (other == this) continue;
+        for (auto page = first; page <= last; ++page) {
+            auto &word = other->code_pages[(page >> 6) % other->code_pages.size()];
+            if (word.load(std::memory_order_relaxed) & (1ULL << (page & 63)))
+                other->cpu->request_code_invalidation(page << code_page_shift, (page + 1) << code_page_shift);
         }
+    }
+}
+
+bool core_complex::write_cluster_mem(uint64_t addr, unsigned length, const uint8_t *const data) {
+    // other cores must not observe the store within their atomic section nor keep a reservation of its address
+    if (cluster->enter_unserialized_store()) {
+        auto done = write_dmi(addr, length, data);
+        cluster->leave_unserialized_store();
+        if (done) return true;
+    }
+    auto started = cluster->enter_store(*this, addr, length);
+    if (started) in_atomic_section = true;
+    auto res = write_dmi(addr, length, data) || write_bus(addr, length, data);
+    if (started) {
+        in_atomic_section = false;
+        cluster->leave_store(*this);
+    }
+    return res;
+}
+
+bool core_complex::write_dmi(uint64_t addr, unsigned length, const uint8_t *const data) {
+    auto &lut_entry = get_dmi_entry(write_lut, write_mru, addr, length);
+    if (lut_entry.get_granted_access() == tlm::tlm_dmi::DMI_ACCESS_NONE) return false;
+    auto offset = addr - lut_entry.get_start_address();
+    std::copy(data, data + length, lut_entry.get_dmi_ptr() + offset);
+    if (lut_entry.get_write_latency() != SC_ZERO_TIME) quantum_keeper.inc(lut_entry.get_write_latency());
+    return true;
+}
+
+bool core_complex::write_bus(uint64_t addr, unsigned length, const uint8_t *const data) {
+    sync(cpu->get_cycle()); // bring the local time up to date before leaving DMI
+    mtime_valid = false;    // the write might go to the timer
+#ifdef WITH_SCV
+    wait_instr_records();
 #endif
-        initiator->b_transport(gp, delay);
-        quantum_keeper.set(delay);
-        SCCTRACE() << "write_mem(0x" << std::hex << addr << ") : " << data;
-        if (gp.get_response_status() != tlm::TLM_OK_RESPONSE) {
-            return false;
-        }
-        if (gp.is_dmi_allowed()) {
-            gp.set_command(tlm::TLM_READ_COMMAND);
-            gp.set_address(addr);
-            tlm_dmi_ext dmi_data;
-            if (initiator->get_direct_mem_ptr(gp, dmi_data)) {
-                if (dmi_data.is_read_allowed())
-                    read_lut.addEntry(dmi_data, dmi_data.get_start_address(),
-                                      dmi_data.get_end_address() - dmi_data.get_start_address() + 1);
-                if (dmi_data.is_write_allowed())
-                    write_lut.addEntry(dmi_data, dmi_data.get_start_address(),
-                                       dmi_data.get_end_address() - dmi_data.get_start_address() + 1);
-            }
+    bool res = false;
+    if (cluster)
+        cluster->execute(*this, [&]() { res = transport_write(addr, length, data); });
+    else
+        res = transport_write(addr, length, data);
+    // the fetch buffers of the other cores hold lines of memory without DMI, e.g. the one just written
+    if (res)
+        for (auto *other : all_cores)
+            if (other != this) other->fetch_buf_stale = true;
+    return res;
+}
+
+bool core_complex::transport_write(uint64_t addr, unsigned length, const uint8_t *const data) {
+    auto gp_ptr = payload_pool.allocate();
+    auto &gp = *gp_ptr;
+    gp.set_command(tlm::TLM_WRITE_COMMAND);
+    gp.set_address(addr);
+    // a target must not modify the data array of a write command, hence the data is passed without a copy
+    gp.set_data_ptr(const_cast<uint8_t *>(data));
+    gp.set_data_length(length);
+    gp.set_streaming_width(length);
+    sc_time delay{quantum_keeper.get_local_time()};
+#ifdef WITH_SCV
+    if (m_db != nullptr && tr_handle.is_valid()) {
+        auto preExt = new scv4tlm::tlm_recording_extension(tr_handle, this);
+        gp.set_auto_extension(preExt);
+    }
+#endif
+    initiator->b_transport(gp, delay);
+    quantum_keeper.set(delay);
+    SCCTRACE() << "write_mem(0x" << std::hex << addr << ") : " << data;
+    if (gp.get_response_status() != tlm::TLM_OK_RESPONSE) {
+        return false;
+    }
+    if (gp.is_dmi_allowed()) {
+        gp.set_command(tlm::TLM_READ_COMMAND);
+        gp.set_address(addr);
+        tlm_dmi_ext dmi_data;
+        if (initiator->get_direct_mem_ptr(gp, dmi_data)) {
+            if (dmi_data.is_read_allowed())
+                read_lut.addEntry(dmi_data, dmi_data.get_start_address(),
+                                  dmi_data.get_end_address() - dmi_data.get_start_address() + 1);
+            if (dmi_data.is_write_allowed())
+                write_lut.addEntry(dmi_data, dmi_data.get_start_address(),
+                                   dmi_data.get_end_address() - dmi_data.get_start_address() + 1);
         }
-        return true;
     }
+    return true;
 }
 
 bool core_complex::read_mem_dbg(uint64_t addr, unsigned length, uint8_t *const data) {
-    auto lut_entry = read_lut.getEntry(addr);
-    if (lut_entry.get_granted_access() != tlm::tlm_dmi::DMI_ACCESS_NONE &&
-        addr + length <= lut_entry.get_end_address() + 1) {
+    auto &lut_entry = get_dmi_entry(read_lut, read_mru, addr, length);
+    if (lut_entry.get_granted_access() != tlm::tlm_dmi::DMI_ACCESS_NONE) {
         auto offset = addr - lut_entry.get_start_address();
         std::copy(lut_entry.get_dmi_ptr() + offset, lut_entry.get_dmi_ptr() + offset + length, data);
-        quantum_keeper.inc(lut_entry.get_read_latency());
+        if (lut_entry.get_read_latency() != SC_ZERO_TIME) quantum_keeper.inc(lut_entry.get_read_latency());
         return true;
     } else {
         tlm::tlm_generic_payload gp;
@@ -481,12 +952,12 @@ bool core_complex::read_mem_dbg(uint64_t addr, unsigned length, uint8_t *const d
 }
 
 bool core_complex::write_mem_dbg(uint64_t addr, unsigned length, const uint8_t *const data) {
-    auto lut_entry = write_lut.getEntry(addr);
-    if (lut_entry.get_granted_access() != tlm::tlm_dmi::DMI_ACCESS_NONE &&
-        addr + length <= lut_entry.get_end_address() + 1) {
+    invalidate_fetch_buf(addr, length);
+    auto &lut_entry = get_dmi_entry(write_lut, write_mru, addr, length);
+    if (lut_entry.get_granted_access() != tlm::tlm_dmi::DMI_ACCESS_NONE) {
         auto offset = addr - lut_entry.get_start_address();
         std::copy(data, data + length, lut_entry.get_dmi_ptr() + offset);
-        quantum_keeper.inc(lut_entry.get_read_latency());
+        if (lut_entry.get_write_latency() != SC_ZERO_TIME) quantum_keeper.inc(lut_entry.get_write_latency());
         return true;
     } else {
         write_buf.resize(length);
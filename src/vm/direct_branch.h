@@ -0,0 +1,103 @@
+/*******************************************************************************
+ * Copyright (C) 2017, 2018 MINRES Technologies GmbH
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ *******************************************************************************/
+
+
+#ifndef _VM_DIRECT_BRANCH_H_
+#define _VM_DIRECT_BRANCH_H_
+
+#include <cstdint>
+
+namespace iss {
+namespace arch {
+/**
+ * description of a control transfer instruction with a pc-relative, statically known target
+ */
+struct direct_branch {
+    enum kind_e { NONE, JUMP, CONDITIONAL } kind;
+    uint64_t target;
+};
+
+template <typename T, unsigned B> inline T sign_extend(uint32_t val) {
+    return static_cast<T>(static_cast<int64_t>(static_cast<uint64_t>(val) << (64 - B)) >> (64 - B));
+}
+/**
+ * decode JAL, Bxx, C.J, C.JAL (RV32 only), C.BEQZ and C.BNEZ and return their target. The caller is
+ * responsible to check that the instruction is implemented by the ISA at hand.
+ *
+ * @param insn the instruction word
+ * @param pc the address of the instruction
+ * @return the branch description, kind is NONE for all other instructions
+ */
+template <unsigned XLEN> inline direct_branch decode_direct_branch(uint32_t insn, uint64_t pc) {
+    const uint64_t mask = XLEN == 64 ? ~0ULL : (1ULL << XLEN) - 1;
+    if ((insn & 0x3) == 0x3) {
+        switch (insn & 0x7f) {
+        case 0x6f: { // JAL
+            auto imm = ((insn >> 31) & 0x1) << 20 | ((insn >> 21) & 0x3ff) << 1 | ((insn >> 20) & 0x1) << 11 |
+                       ((insn >> 12) & 0xff) << 12;
+            return {direct_branch::JUMP, (pc + sign_extend<int64_t, 21>(imm)) & mask};
+        }
+        case 0x63: { // BEQ, BNE, BLT, BGE, BLTU, BGEU
+            auto imm = ((insn >> 31) & 0x1) << 12 | ((insn >> 25) & 0x3f) << 5 | ((insn >> 8) & 0xf) << 1 |
+                       ((insn >> 7) & 0x1) << 11;
+            return {direct_branch::CONDITIONAL, (pc + sign_extend<int64_t, 13>(imm)) & mask};
+        }
+        default:
+            return {direct_branch::NONE, 0};
+        }
+    }
+    if ((insn & 0x3) != 0x1) return {direct_branch::NONE, 0};
+    switch ((insn >> 13) & 0x7) {
+    case 1: // C.JAL on RV32, C.ADDIW otherwise
+        if (XLEN != 32) break;
+        /* FALLTHRU */
+    case 5: { // C.J
+        auto imm = ((insn >> 12) & 0x1) << 11 | ((insn >> 11) & 0x1) << 4 | ((insn >> 9) & 0x3) << 8 |
+                   ((insn >> 8) & 0x1) << 10 | ((insn >> 7) & 0x1) << 6 | ((insn >> 6) & 0x1) << 7 |
+                   ((insn >> 3) & 0x7) << 1 | ((insn >> 2) & 0x1) << 5;
+        return {direct_branch::JUMP, (pc + sign_extend<int64_t, 12>(imm)) & mask};
+    }
+    case 6: // C.BEQZ
+    case 7: { // C.BNEZ
+        auto imm = ((insn >> 12) & 0x1) << 8 | ((insn >> 10) & 0x3) << 3 | ((insn >> 5) & 0x3) << 6 |
+                   ((insn >> 3) & 0x3) << 1 | ((insn >> 2) & 0x1) << 5;
+        return {direct_branch::CONDITIONAL, (pc + sign_extend<int64_t, 9>(imm)) & mask};
+    }
+    default:
+        break;
+    }
+    return {direct_branch::NONE, 0};
+}
+}
+}
+
+#endif /* _VM_DIRECT_BRANCH_H_ */
@@ -46,6 +46,7 @@
 #include <fmt/format.h>
 
 #include <array>
+#include <mutex>
 #include <iss/debugger/riscv_target_adapter.h>
 
 namespace iss {
@@ -72,8 +73,10 @@ public:
 
     target_adapter_if *accquire_target_adapter(server_if *srv) override {
         debugger_if::dbg_enabled = true;
-        if (super::tgt_adapter == nullptr)
+        if (super::tgt_adapter == nullptr) {
             super::tgt_adapter = new riscv_target_adapter<ARCH>(srv, this->get_arch());
+            add_stats_command(super::tgt_adapter, this);
+        }
         return super::tgt_adapter;
     }
 
@@ -92,10 +95,11 @@ protected:
     enum { EXTR_MASK16 = MASK16 >> 2, EXTR_MASK32 = MASK32 >> 2 };
     enum { LUT_SIZE = 1 << util::bit_count(EXTR_MASK32), LUT_SIZE_C = 1 << util::bit_count(EXTR_MASK16) };
 
-    std::array<compile_func, LUT_SIZE> lut;
-
-    std::array<compile_func, LUT_SIZE_C> lut_00, lut_01, lut_10;
-    std::array<compile_func, LUT_SIZE> lut_11;
+    // the decoding tables only depend on the core type, they are built once and shared by all instances
+    struct decoding_luts {
+        std::array<compile_func, LUT_SIZE_C> lut_00, lut_01, lut_10;
+        std::array<compile_func, LUT_SIZE> lut_11;
+    };
 
     std::array<compile_func *, 4> qlut;
 
@@ -8645,14 +8649,18 @@ template <typename ARCH> vm_impl<ARCH>::vm_impl() { this(new ARCH()); }
 template <typename ARCH>
 vm_impl<ARCH>::vm_impl(ARCH &core, unsigned core_id, unsigned cluster_id)
 : vm_base<ARCH>(core, core_id, cluster_id) {
-    qlut[0] = lut_00.data();
-    qlut[1] = lut_01.data();
-    qlut[2] = lut_10.data();
-    qlut[3] = lut_11.data();
-    for (auto instr : instr_descr) {
-        auto quantrant = instr.value & 0x3;
-        expand_bit_mask(29, lutmasks[quantrant], instr.value >> 2, instr.mask >> 2, 0, qlut[quantrant], instr.op);
-    }
+    static decoding_luts luts;
+    static std::once_flag luts_built;
+    qlut[0] = luts.lut_00.data();
+    qlut[1] = luts.lut_01.data();
+    qlut[2] = luts.lut_10.data();
+    qlut[3] = luts.lut_11.data();
+    std::call_once(luts_built, [this]() {
+        for (auto instr : instr_descr) {
+            auto quantrant = instr.value & 0x3;
+            expand_bit_mask(29, lutmasks[quantrant], instr.value >> 2, instr.mask >> 2, 0, qlut[quantrant], instr.op);
+        }
+    });
 }
 
 template <typename ARCH>
@@ -8663,7 +8671,10 @@ typename vm_base<ARCH>::virt_addr_t vm_impl<ARCH>::execute_inst(virt_addr_t star
     code_word_t insn = 0;
     auto *const data = (uint8_t *)&insn;
     auto pc=start;
-    while(pred){
+    // the predicate is only evaluated when the control flow leaves a straight-line sequence of instructions,
+    // i.e. at the same granularity the translating backends check it at block exits
+    auto cont = pred();
+    while(cont){
         auto paddr = this->core.v2p(pc);
         if ((pc.val & upper_bits) != ((pc.val + 2) & upper_bits)) { // we may cross a page boundary
             if (this->core.read(paddr, 2, data) != iss::Ok) throw trap_access(TRAP_ID, pc.val);
@@ -8677,7 +8688,13 @@ typename vm_base<ARCH>::virt_addr_t vm_impl<ARCH>::execute_inst(virt_addr_t star
         auto f = qlut[insn & 0x3][lut_val];
         if (!f)
             f = &this_class::illegal_intruction;
+        auto next_pc = pc.val + ((insn & 0x3) == 0x3 ? 4 : 2);
+        // AMOs and LR/SC are serialized with other harts sharing the memory from the start of the instruction to
+        // their last memory access, an LR to x0 does not access memory
+        if ((insn & 0x7f) == 0x2f && ((insn >> 27) != 0x2 || (insn & 0xf80) != 0))
+            super::write_mem(traits<ARCH>::FENCE, 4, static_cast<uint32_t>(0));
         pc = (this->*f)(pc, insn);
+        if (pc.val != next_pc) cont = pred();
     }
     return pc;
 }
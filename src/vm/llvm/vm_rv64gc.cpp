@@ -30,6 +30,7 @@
  *
  *******************************************************************************/
 
+#include "../direct_branch.h"
 #include <iss/arch/rv64gc.h>
 #include <iss/arch/riscv_hart_msu_vp.h>
 #include <iss/debugger/gdb_session.h>
@@ -44,6 +45,12 @@
 #include <fmt/format.h>
 
 #include <array>
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <set>
+#include <unordered_map>
+#include <unordered_set>
 #include <iss/debugger/riscv_target_adapter.h>
 
 namespace iss {
@@ -57,7 +64,7 @@ using namespace ::llvm;
 using namespace iss::arch;
 using namespace iss::debugger;
 
-template <typename ARCH> class vm_impl : public iss::llvm::vm_base<ARCH> {
+template <typename ARCH> class vm_impl : public iss::llvm::vm_base<ARCH>, public iss::statistics_if {
 public:
     using super = typename iss::llvm::vm_base<ARCH>;
     using virt_addr_t = typename super::virt_addr_t;
@@ -73,14 +80,46 @@ public:
 
     target_adapter_if *accquire_target_adapter(server_if *srv) override {
         debugger_if::dbg_enabled = true;
-        if (vm_base<ARCH>::tgt_adapter == nullptr)
-            vm_base<ARCH>::tgt_adapter = new riscv_target_adapter<ARCH>(srv, this->get_arch());
+        if (vm_base<ARCH>::tgt_adapter == nullptr) {
+            rv_tgt_adapter = new riscv_target_adapter<ARCH>(srv, this->get_arch());
+            rv_tgt_adapter->set_break_change_handler([this](uint64_t start, uint64_t end) {
+                if (code_tracker != nullptr) code_tracker->request_code_invalidation(start, end);
+            });
+            rv_tgt_adapter->set_resume_handler([this](bool step) { set_debug_stepping(step); });
+            vm_base<ARCH>::tgt_adapter = rv_tgt_adapter;
+            add_stats_command(vm_base<ARCH>::tgt_adapter, this);
+        }
         return vm_base<ARCH>::tgt_adapter;
     }
 
+    void collect_statistics(iss::statistics &stats) const override { stats += vm_stats; }
+
 protected:
     using vm_base<ARCH>::get_reg_ptr;
 
+    iss::statistics vm_stats;
+
+    // start addresses of the translated blocks containing instructions of a physical page
+    std::unordered_map<uint64_t, std::unordered_set<uint64_t>> page_blocks;
+
+    uint64_t block_start = 0;
+
+    void invalidate_code(uint64_t start, uint64_t end);
+
+    riscv_target_adapter<ARCH> *rv_tgt_adapter = nullptr;
+
+    // set while the debugger lets the core run freely, only block entries and breakpoints sync with it then
+    bool dbg_free_run = false;
+
+    // stepping mode requested by the debugger thread, it is applied by the simulation thread at a block boundary
+    std::atomic<bool> dbg_step_requested{true};
+
+    iss::code_tracking_if *code_tracker = nullptr;
+
+    void set_debug_stepping(bool step);
+
+    void apply_debug_stepping();
+
     inline const char *name(size_t index){return traits<ARCH>::reg_aliases.at(index);}
 
     template <typename T> inline ConstantInt *size(T type) {
@@ -98,6 +137,8 @@ protected:
 
     std::tuple<continuation_e, BasicBlock *> gen_single_inst_behavior(virt_addr_t &, unsigned int &, BasicBlock *) override;
 
+    BasicBlock *follow_branch(uint64_t cur_pc, code_word_t insn, virt_addr_t &pc);
+
     void gen_leave_behavior(BasicBlock *leave_blk) override;
 
     void gen_raise_trap(uint16_t trap_id, uint16_t cause);
@@ -110,14 +151,91 @@ protected:
 
     void gen_trap_check(BasicBlock *bb);
 
+    // the X and F registers are only accessed by the translated code (and by the debugger at sync points), so their
+    // values are kept in SSA form along a chain of basic blocks. The stores the instructions emit into the register
+    // file are taken out again and written back only where the values may be observed: on the trap paths, when
+    // leaving the block, before syncs and where the control flow of an instruction forks
+    std::unordered_map<unsigned, Value *> reg_cache;
+
+    // registers whose cached value has not been written back yet
+    std::set<unsigned> dirty_regs;
+
+    // register file locations of the cached registers
+    std::unordered_map<Value *, unsigned> reg_locations;
+
+    // stores of the write back, they must not be taken into the cache again
+    std::unordered_set<Instruction *> write_backs;
+
+    // write back at the end of the last instruction, it is dead if the block continues with a further instruction
+    std::vector<Instruction *> tentative_write_backs;
+
+    BasicBlock *reg_cache_blk = nullptr;
+
+    static constexpr bool is_cacheable_reg(unsigned i) {
+        return i < traits<ARCH>::PC ||
+               (traits<ARCH>::FP_REGS_SIZE > 0 && i > traits<ARCH>::PC && i <= traits<ARCH>::PC + 32);
+    }
+
+    inline bool is_cached_reg(unsigned i) { return !reg_locations.empty() && is_cacheable_reg(i); }
+
+    void start_reg_cache();
+
+    std::unordered_map<unsigned, Value *> &current_reg_cache();
+
+    void capture_reg_stores(BasicBlock *blk);
+
+    void write_back_regs(BasicBlock *blk, bool tentative = false);
+
     inline Value *gen_reg_load(unsigned i, unsigned level = 0) {
-        return this->builder.CreateLoad(get_reg_ptr(i), false);
+        if (!is_cached_reg(i)) return this->builder.CreateLoad(get_reg_ptr(i), false);
+        auto &cache = current_reg_cache();
+        auto it = cache.find(i);
+        if (it != cache.end()) return it->second;
+        return cache[i] = this->builder.CreateLoad(get_reg_ptr(i), false);
     }
 
+    // set if the instruction being translated may raise a trap, only then it needs a trap check
+    bool may_trap = false;
+
+    template <typename... Args>
+    inline auto gen_read_mem(Args &&... args) -> decltype(super::gen_read_mem(std::forward<Args>(args)...)) {
+        may_trap = true;
+        return super::gen_read_mem(std::forward<Args>(args)...);
+    }
+
+    template <typename... Args>
+    inline auto gen_write_mem(Args &&... args) -> decltype(super::gen_write_mem(std::forward<Args>(args)...)) {
+        may_trap = true;
+        return super::gen_write_mem(std::forward<Args>(args)...);
+    }
+
+    // the debugger may read and modify registers when the sync callbacks are executed
+    template <typename S> inline void gen_sync(S s, unsigned inst_id) {
+        if (super::sync_exec & s) {
+            may_trap = true;
+            current_reg_cache();
+            write_back_regs(this->builder.GetInsertBlock());
+            reg_cache.clear();
+        }
+        super::gen_sync(s, inst_id);
+    }
+
+    // address of the instruction being translated, it is only materialized when a trap is taken
+    uint64_t inst_pc = 0;
+
+    // the last constant store to NEXT_PC, it is dead if the next one follows without being observed
+    StoreInst *next_pc_store = nullptr;
+
+    bool is_next_pc_observed(StoreInst *store);
+
     inline void gen_set_pc(virt_addr_t pc, unsigned reg_num) {
         Value *next_pc_v = this->builder.CreateSExtOrTrunc(this->gen_const(traits<ARCH>::XLEN, pc.val),
                                                            this->get_type(traits<ARCH>::XLEN));
-        this->builder.CreateStore(next_pc_v, get_reg_ptr(reg_num), true);
+        auto *store = this->builder.CreateStore(next_pc_v, get_reg_ptr(reg_num), false);
+        if (reg_num == traits<ARCH>::NEXT_PC) {
+            if (next_pc_store != nullptr && !is_next_pc_observed(next_pc_store)) next_pc_store->eraseFromParent();
+            next_pc_store = store;
+        }
     }
 
     // some compile time constants
@@ -130,10 +248,11 @@ protected:
     using compile_func = std::tuple<continuation_e, BasicBlock *> (this_class::*)(virt_addr_t &pc,
                                                                                   code_word_t instr,
                                                                                   BasicBlock *bb);
-    std::array<compile_func, LUT_SIZE> lut;
-
-    std::array<compile_func, LUT_SIZE_C> lut_00, lut_01, lut_10;
-    std::array<compile_func, LUT_SIZE> lut_11;
+    // the decoding tables only depend on the core type, they are built once and shared by all instances
+    struct decoding_luts {
+        std::array<compile_func, LUT_SIZE_C> lut_00, lut_01, lut_10;
+        std::array<compile_func, LUT_SIZE> lut_11;
+    };
 
 	std::array<compile_func *, 4> qlut;
 
@@ -11234,12 +11353,8 @@ private:
      ****************************************************************************/
     std::tuple<continuation_e, BasicBlock *> illegal_intruction(virt_addr_t &pc, code_word_t instr, BasicBlock *bb) {
 		this->gen_sync(iss::PRE_SYNC, instr_descr.size());
-        this->builder.CreateStore(this->builder.CreateLoad(get_reg_ptr(traits<ARCH>::NEXT_PC), true),
-                                   get_reg_ptr(traits<ARCH>::PC), true);
-        this->builder.CreateStore(
-            this->builder.CreateAdd(this->builder.CreateLoad(get_reg_ptr(traits<ARCH>::ICOUNT), true),
-                                     this->gen_const(64U, 1)),
-            get_reg_ptr(traits<ARCH>::ICOUNT), true);
+        this->builder.CreateStore(this->builder.CreateLoad(get_reg_ptr(traits<ARCH>::NEXT_PC), false),
+                                   get_reg_ptr(traits<ARCH>::PC), false);
         pc = pc + ((instr & 3) == 3 ? 4 : 2);
         this->gen_raise_trap(0, 2);     // illegal instruction trap
 		this->gen_sync(iss::POST_SYNC, instr_descr.size());
@@ -11258,14 +11373,24 @@ template <typename ARCH> vm_impl<ARCH>::vm_impl() { this(new ARCH()); }
 template <typename ARCH>
 vm_impl<ARCH>::vm_impl(ARCH &core, unsigned core_id, unsigned cluster_id)
 : vm_base<ARCH>(core, core_id, cluster_id) {
-    qlut[0] = lut_00.data();
-    qlut[1] = lut_01.data();
-    qlut[2] = lut_10.data();
-    qlut[3] = lut_11.data();
-    for (auto instr : instr_descr) {
-        auto quantrant = instr.value & 0x3;
-        expand_bit_mask(29, lutmasks[quantrant], instr.value >> 2, instr.mask >> 2, 0, qlut[quantrant], instr.op);
-    }
+    static decoding_luts luts;
+    static std::once_flag luts_built;
+    qlut[0] = luts.lut_00.data();
+    qlut[1] = luts.lut_01.data();
+    qlut[2] = luts.lut_10.data();
+    qlut[3] = luts.lut_11.data();
+    std::call_once(luts_built, [this]() {
+        for (auto instr : instr_descr) {
+            auto quantrant = instr.value & 0x3;
+            expand_bit_mask(29, lutmasks[quantrant], instr.value >> 2, instr.mask >> 2, 0, qlut[quantrant], instr.op);
+        }
+    });
+    code_tracker = dynamic_cast<iss::code_tracking_if *>(&core);
+    if (code_tracker != nullptr)
+        code_tracker->set_code_invalidation_handler([this](uint64_t start, uint64_t end) {
+            apply_debug_stepping();
+            invalidate_code(start, end);
+        });
 }
 
 template <typename ARCH>
@@ -11273,6 +11398,18 @@ std::tuple<continuation_e, BasicBlock *>
 vm_impl<ARCH>::gen_single_inst_behavior(virt_addr_t &pc, unsigned int &inst_cnt, BasicBlock *this_block) {
     // we fetch at max 4 byte, alignment is 2
     enum {TRAP_ID=1<<16};
+    auto start = std::chrono::steady_clock::now();
+    if (inst_cnt == 0) {
+        vm_stats.blocks_translated++;
+        start_reg_cache();
+        next_pc_store = nullptr;
+    } else { // the block continues, the values stay in the cache
+        for (auto *store : tentative_write_backs) {
+            write_backs.erase(store);
+            store->eraseFromParent();
+        }
+        tentative_write_backs.clear();
+    }
     code_word_t insn = 0;
     const typename traits<ARCH>::addr_t upper_bits = ~traits<ARCH>::PGMASK;
     phys_addr_t paddr(pc);
@@ -11289,6 +11426,8 @@ vm_impl<ARCH>::gen_single_inst_behavior(virt_addr_t &pc, unsigned int &inst_cnt,
         if (res != iss::Ok) throw trap_access(TRAP_ID, pc.val);
     }
     if (insn == 0x0000006f || (insn&0xffff)==0xa001) throw simulation_stopped(0); // 'J 0' or 'C.J 0'
+    if (inst_cnt == 0) block_start = paddr.val;
+    page_blocks[paddr.val & upper_bits].insert(block_start);
     // curr pc on stack
     ++inst_cnt;
     auto lut_val = extract_fields(insn);
@@ -11296,7 +11435,205 @@ vm_impl<ARCH>::gen_single_inst_behavior(virt_addr_t &pc, unsigned int &inst_cnt,
     if (f == nullptr) {
         f = &this_class::illegal_intruction;
     }
-    return (this->*f)(pc, insn, this_block);
+    inst_pc = pc.val;
+    may_trap = false;
+    // the PC is not updated per instruction, but the hart needs it for CSR accesses (SYSTEM instructions), e.g. to
+    // detect code polling the time
+    if ((insn & 0x7f) == 0x73)
+        this->builder.CreateStore(this->gen_const(traits<ARCH>::XLEN, pc.val), get_reg_ptr(traits<ARCH>::PC), false);
+    // AMOs and LR/SC are serialized with other harts sharing the memory from the start of the instruction to their
+    // last memory access, an LR to x0 does not access memory
+    if ((insn & 0x7f) == 0x2f && ((insn >> 27) != 0x2 || (insn & 0xf80) != 0))
+        this->gen_write_mem(traits<ARCH>::FENCE, this->gen_const(64U, 4), this->gen_const(32U, 0));
+    auto sync_exec = super::sync_exec;
+    if (dbg_free_run && (inst_cnt == 1 || rv_tgt_adapter->has_break(paddr.val))) super::sync_exec = super::ALL_SYNC;
+    auto ret = (this->*f)(pc, insn, this_block);
+    super::sync_exec = sync_exec;
+    // the block may end after this instruction, hence the pending stores are written back at the start of the
+    // successor block. They are removed again if a further instruction gets translated into it
+    if (std::get<0>(ret) == CONT && std::get<1>(ret) != nullptr) {
+        current_reg_cache();
+        write_back_regs(std::get<1>(ret), true);
+    }
+    // superblock formation: extend the block along direct jumps and forward conditional branches. The path is chosen
+    // statically as dbt-core translates a block on its first execution, there are no execution counts to guide it
+    if (std::get<0>(ret) == BRANCH && f != &this_class::illegal_intruction)
+        if (auto *bb = follow_branch(inst_pc, insn, pc)) ret = std::make_tuple(CONT, bb);
+    vm_stats.instructions_translated++;
+    vm_stats.translation_ns +=
+        std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+    return ret;
+}
+
+template <typename ARCH>
+BasicBlock *vm_impl<ARCH>::follow_branch(uint64_t cur_pc, code_word_t insn, virt_addr_t &pc) {
+    // only forward targets within the page are followed, this keeps the addresses of the instructions
+    // in a block ascending and the size of the block bounded
+    const typename traits<ARCH>::addr_t upper_bits = ~traits<ARCH>::PGMASK;
+    auto br = decode_direct_branch<traits<ARCH>::XLEN>(insn, cur_pc);
+    if (br.kind == direct_branch::NONE || br.target <= cur_pc || (br.target & upper_bits) != (cur_pc & upper_bits))
+        return nullptr;
+    auto *term = this->builder.GetInsertBlock()->getTerminator();
+    if (term == nullptr) return nullptr;
+    auto *bb = BasicBlock::Create(this->mod->getContext(), "entry", this->func, this->leave_blk);
+    auto *succ = bb;
+    if (br.kind == direct_branch::JUMP)
+        pc.val = br.target;
+    else { // continue along the fall through path and leave the block if the branch is taken
+        succ = BasicBlock::Create(this->mod->getContext(), "side_exit", this->func, this->leave_blk);
+        this->builder.SetInsertPoint(succ);
+        auto *next_pc_v = this->builder.CreateLoad(get_reg_ptr(traits<ARCH>::NEXT_PC), false);
+        this->builder.CreateCondBr(
+            this->builder.CreateICmp(ICmpInst::ICMP_EQ, next_pc_v, this->gen_const(traits<ARCH>::XLEN, pc.val)), bb,
+            this->leave_blk);
+    }
+    // redirect the regular exit of the branch instruction into the continuation of the block
+    for (unsigned i = 0; i < term->getNumSuccessors(); ++i)
+        if (term->getSuccessor(i) == this->leave_blk) term->setSuccessor(i, succ);
+    this->builder.SetInsertPoint(bb);
+    // the followed branch must not appear as the last branch when the block ends further down
+    this->builder.CreateStore(this->gen_const(32U, std::numeric_limits<uint32_t>::max()),
+                              get_reg_ptr(traits<ARCH>::LAST_BRANCH), false);
+    return bb;
+}
+
+template <typename ARCH> void vm_impl<ARCH>::set_debug_stepping(bool step) {
+    // called by the debugger thread while the simulation may be within a block, hence the switch is only recorded.
+    // The empty range just has the invalidation handler called at the next block boundary
+    if (dbg_step_requested.exchange(step) != step && code_tracker != nullptr)
+        code_tracker->request_code_invalidation(0, 0);
+}
+
+template <typename ARCH> void vm_impl<ARCH>::apply_debug_stepping() {
+    // single steps need a sync per instruction, hence the code is translated again when the mode changed. A step
+    // followed by a continue before the core reached a block boundary does not change it
+    bool step = dbg_step_requested;
+    if (dbg_free_run == !step) return;
+    dbg_free_run = !step;
+    if (step)
+        super::sync_exec = super::ALL_SYNC;
+    else
+        super::sync_exec = this->core.needed_sync();
+    invalidate_code(0, std::numeric_limits<uint64_t>::max());
+}
+
+template <typename ARCH> void vm_impl<ARCH>::invalidate_code(uint64_t start, uint64_t end) {
+    // the core calls this at a block boundary, hence none of the blocks is executing. Only the blocks built from
+    // the modified pages are dropped, they get translated again when executed next time
+    const typename traits<ARCH>::addr_t upper_bits = ~traits<ARCH>::PGMASK;
+    bool dropped = false;
+    auto drop_page = [this, &dropped](typename decltype(page_blocks)::iterator it) {
+        for (auto blk : it->second) dropped |= this->func_map.erase(blk) != 0;
+        return page_blocks.erase(it);
+    };
+    if ((end - (start & upper_bits)) / traits<ARCH>::PGSIZE > page_blocks.size()) { // e.g. a flush of all code
+        for (auto it = page_blocks.begin(); it != page_blocks.end();)
+            it = it->first < end && it->first + traits<ARCH>::PGSIZE > start ? drop_page(it) : std::next(it);
+    } else {
+        for (auto page = start & upper_bits; page < end; page += traits<ARCH>::PGSIZE) {
+            auto it = page_blocks.find(page);
+            if (it != page_blocks.end()) drop_page(it);
+        }
+    }
+    // the remaining blocks may be chained to the dropped ones, their successors are looked up again instead
+    if (dropped)
+        for (auto &entry : this->func_map)
+            std::fill(std::begin(entry.second.cont), std::end(entry.second.cont), nullptr);
+}
+
+template <typename ARCH> void vm_impl<ARCH>::start_reg_cache() {
+    reg_cache.clear();
+    dirty_regs.clear();
+    write_backs.clear();
+    tentative_write_backs.clear();
+    reg_cache_blk = nullptr;
+    reg_locations.clear();
+    // stores can only be matched if the register locations are constants, otherwise nothing is cached
+    if (!isa<Constant>(get_reg_ptr(traits<ARCH>::X0))) return;
+    for (unsigned i = 0; i < traits<ARCH>::NUM_REGS; ++i)
+        if (is_cacheable_reg(i)) reg_locations[get_reg_ptr(i)] = i;
+}
+
+template <typename ARCH> std::unordered_map<unsigned, Value *> &vm_impl<ARCH>::current_reg_cache() {
+    // cached values stay valid as long as the current block is only reachable from the block they stem from,
+    // pending stores are written back before the control flow forks or merges
+    auto *cur_blk = this->builder.GetInsertBlock();
+    if (cur_blk != reg_cache_blk) {
+        if (reg_cache_blk != nullptr) {
+            capture_reg_stores(reg_cache_blk);
+            auto chained = cur_blk->getSinglePredecessor() == reg_cache_blk;
+            auto forks = false;
+            if (auto *term = reg_cache_blk->getTerminator()) {
+                auto succs = 0U;
+                for (unsigned i = 0; i < term->getNumSuccessors(); ++i)
+                    if (!term->getSuccessor(i)->getName().startswith("trap_site")) succs++;
+                forks = succs > 1;
+            }
+            if (!chained || forks) write_back_regs(reg_cache_blk);
+            if (!chained) reg_cache.clear();
+        }
+        reg_cache_blk = cur_blk;
+    }
+    capture_reg_stores(cur_blk);
+    return reg_cache;
+}
+
+template <typename ARCH> void vm_impl<ARCH>::capture_reg_stores(BasicBlock *blk) {
+    for (auto it = blk->begin(); it != blk->end();) {
+        auto *store = dyn_cast<StoreInst>(&*it++);
+        if (store == nullptr || write_backs.count(store)) continue;
+        auto loc = reg_locations.find(store->getPointerOperand());
+        if (loc == reg_locations.end()) continue;
+        reg_cache[loc->second] = store->getValueOperand();
+        dirty_regs.insert(loc->second);
+        store->eraseFromParent();
+    }
+}
+
+template <typename ARCH> void vm_impl<ARCH>::write_back_regs(BasicBlock *blk, bool tentative) {
+    // the stores are placed at the current insert point or before the terminator of a finished block
+    IRBuilder<> b(blk);
+    if (blk == this->builder.GetInsertBlock())
+        b.SetInsertPoint(blk, this->builder.GetInsertPoint());
+    else if (auto *term = blk->getTerminator())
+        b.SetInsertPoint(term);
+    for (auto i : dirty_regs) {
+        auto *store = b.CreateStore(reg_cache[i], get_reg_ptr(i), false);
+        write_backs.insert(store);
+        if (tentative) tentative_write_backs.push_back(store);
+    }
+    if (!tentative) dirty_regs.clear();
+}
+
+template <typename ARCH> bool vm_impl<ARCH>::is_next_pc_observed(StoreInst *store) {
+    // walk the chain of blocks from the store to the current insert point, the trap sites need not be
+    // considered as enter_trap sets NEXT_PC before it is read. Everything which gets hold of the core
+    // may read NEXT_PC as well as any other exit of the block
+    auto *cur_blk = this->builder.GetInsertBlock();
+    auto *blk = store->getParent();
+    auto it = std::next(store->getIterator());
+    while (true) {
+        for (; it != blk->end(); ++it) {
+            if (auto *call = dyn_cast<CallInst>(&*it))
+                for (auto &arg : call->arg_operands())
+                    if (arg.get() == this->core_ptr) return true;
+            if (auto *load = dyn_cast<LoadInst>(&*it))
+                if (load->getPointerOperand() == store->getPointerOperand()) return true;
+        }
+        if (blk == cur_blk) return false;
+        auto *term = blk->getTerminator();
+        if (term == nullptr) return true;
+        BasicBlock *next_blk = nullptr;
+        for (unsigned i = 0; i < term->getNumSuccessors(); ++i) {
+            auto *succ = term->getSuccessor(i);
+            if (succ->getName().startswith("trap_site")) continue;
+            if (next_blk != nullptr || succ == this->leave_blk) return true;
+            next_blk = succ;
+        }
+        if (next_blk == nullptr) return true;
+        blk = next_blk;
+        it = blk->begin();
+    }
 }
 
 template <typename ARCH> void vm_impl<ARCH>::gen_leave_behavior(BasicBlock *leave_blk) {
@@ -11305,12 +11642,14 @@ template <typename ARCH> void vm_impl<ARCH>::gen_leave_behavior(BasicBlock *leav
 }
 
 template <typename ARCH> void vm_impl<ARCH>::gen_raise_trap(uint16_t trap_id, uint16_t cause) {
+    may_trap = true;
     auto *TRAP_val = this->gen_const(32, 0x80 << 24 | (cause << 16) | trap_id);
-    this->builder.CreateStore(TRAP_val, get_reg_ptr(traits<ARCH>::TRAP_STATE), true);
+    this->builder.CreateStore(TRAP_val, get_reg_ptr(traits<ARCH>::TRAP_STATE), false);
     this->builder.CreateStore(this->gen_const(32U, std::numeric_limits<uint32_t>::max()), get_reg_ptr(traits<ARCH>::LAST_BRANCH), false);
 }
 
 template <typename ARCH> void vm_impl<ARCH>::gen_leave_trap(unsigned lvl) {
+    may_trap = true;
     std::vector<Value *> args{ this->core_ptr, ConstantInt::get(getContext(), APInt(64, lvl)) };
     this->builder.CreateCall(this->mod->getFunction("leave_trap"), args);
     auto *PC_val = this->gen_read_mem(traits<ARCH>::CSR, (lvl << 8) + 0x41, traits<ARCH>::XLEN / 8);
@@ -11319,13 +11658,14 @@ template <typename ARCH> void vm_impl<ARCH>::gen_leave_trap(unsigned lvl) {
 }
 
 template <typename ARCH> void vm_impl<ARCH>::gen_wait(unsigned type) {
+    may_trap = true;
     std::vector<Value *> args{ this->core_ptr, ConstantInt::get(getContext(), APInt(64, type)) };
     this->builder.CreateCall(this->mod->getFunction("wait"), args);
 }
 
 template <typename ARCH> void vm_impl<ARCH>::gen_trap_behavior(BasicBlock *trap_blk) {
     this->builder.SetInsertPoint(trap_blk);
-    auto *trap_state_val = this->builder.CreateLoad(get_reg_ptr(traits<ARCH>::TRAP_STATE), true);
+    auto *trap_state_val = this->builder.CreateLoad(get_reg_ptr(traits<ARCH>::TRAP_STATE), false);
     this->builder.CreateStore(this->gen_const(32U, std::numeric_limits<uint32_t>::max()),
                               get_reg_ptr(traits<ARCH>::LAST_BRANCH), false);
     std::vector<Value *> args{this->core_ptr, this->adj_to64(trap_state_val),
@@ -11336,11 +11676,27 @@ template <typename ARCH> void vm_impl<ARCH>::gen_trap_behavior(BasicBlock *trap_
 }
 
 template <typename ARCH> inline void vm_impl<ARCH>::gen_trap_check(BasicBlock *bb) {
-    auto *v = this->builder.CreateLoad(get_reg_ptr(arch::traits<ARCH>::TRAP_STATE), true);
+    current_reg_cache();
+    if (bb == this->leave_blk) write_back_regs(this->builder.GetInsertBlock());
+    // TRAP_STATE can only have changed if the instruction accessed memory, raised or left a trap or synced
+    if (!may_trap) {
+        this->builder.CreateBr(bb);
+        return;
+    }
+    auto *v = this->builder.CreateLoad(get_reg_ptr(arch::traits<ARCH>::TRAP_STATE), false);
+    // the address of the faulting instruction and the pending register values are only stored on the (cold)
+    // path into the trap block
+    auto *trap_site = BasicBlock::Create(this->mod->getContext(), "trap_site", this->func, this->trap_blk);
+    auto ip = this->builder.saveIP();
+    this->builder.SetInsertPoint(trap_site);
+    this->builder.CreateStore(this->gen_const(traits<ARCH>::XLEN, inst_pc), get_reg_ptr(traits<ARCH>::PC), false);
+    for (auto i : dirty_regs) this->builder.CreateStore(reg_cache[i], get_reg_ptr(i), false);
+    this->builder.CreateBr(this->trap_blk);
+    this->builder.restoreIP(ip);
     this->gen_cond_branch(this->builder.CreateICmp(
                               ICmpInst::ICMP_EQ, v,
                               ConstantInt::get(getContext(), APInt(v->getType()->getIntegerBitWidth(), 0))),
-                          bb, this->trap_blk, 1);
+                          bb, trap_site, 1);
 }
 
 } // namespace rv64gc
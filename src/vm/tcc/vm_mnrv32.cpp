@@ -30,6 +30,7 @@
  *
  *******************************************************************************/
 
+#include "../direct_branch.h"
 #include <iss/arch/mnrv32.h>
 #include <iss/arch/riscv_hart_msu_vp.h>
 #include <iss/debugger/gdb_session.h>
@@ -45,6 +46,11 @@
 #include <fmt/format.h>
 
 #include <array>
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <unordered_map>
+#include <unordered_set>
 #include <iss/debugger/riscv_target_adapter.h>
 
 namespace iss {
@@ -53,7 +59,7 @@ namespace mnrv32 {
 using namespace iss::arch;
 using namespace iss::debugger;
 
-template <typename ARCH> class vm_impl : public iss::tcc::vm_base<ARCH> {
+template <typename ARCH> class vm_impl : public iss::tcc::vm_base<ARCH>, public iss::statistics_if {
 public:
     using super       = typename iss::tcc::vm_base<ARCH>;
     using virt_addr_t = typename super::virt_addr_t;
@@ -70,14 +76,46 @@ public:
 
     target_adapter_if *accquire_target_adapter(server_if *srv) override {
         debugger_if::dbg_enabled = true;
-        if (vm_base<ARCH>::tgt_adapter == nullptr)
-            vm_base<ARCH>::tgt_adapter = new riscv_target_adapter<ARCH>(srv, this->get_arch());
+        if (vm_base<ARCH>::tgt_adapter == nullptr) {
+            rv_tgt_adapter = new riscv_target_adapter<ARCH>(srv, this->get_arch());
+            rv_tgt_adapter->set_break_change_handler([this](uint64_t start, uint64_t end) {
+                if (code_tracker != nullptr) code_tracker->request_code_invalidation(start, end);
+            });
+            rv_tgt_adapter->set_resume_handler([this](bool step) { set_debug_stepping(step); });
+            vm_base<ARCH>::tgt_adapter = rv_tgt_adapter;
+            add_stats_command(vm_base<ARCH>::tgt_adapter, this);
+        }
         return vm_base<ARCH>::tgt_adapter;
     }
 
+    void collect_statistics(iss::statistics &stats) const override { stats += vm_stats; }
+
 protected:
     using vm_base<ARCH>::get_reg_ptr;
 
+    iss::statistics vm_stats;
+
+    // start addresses of the translated blocks containing instructions of a physical page
+    std::unordered_map<uint64_t, std::unordered_set<uint64_t>> page_blocks;
+
+    uint64_t block_start = 0;
+
+    void invalidate_code(uint64_t start, uint64_t end);
+
+    riscv_target_adapter<ARCH> *rv_tgt_adapter = nullptr;
+
+    // set while the debugger lets the core run freely, only block entries and breakpoints sync with it then
+    bool dbg_free_run = false;
+
+    // stepping mode requested by the debugger thread, it is applied by the simulation thread at a block boundary
+    std::atomic<bool> dbg_step_requested{true};
+
+    iss::code_tracking_if *code_tracker = nullptr;
+
+    void set_debug_stepping(bool step);
+
+    void apply_debug_stepping();
+
     using this_class = vm_impl<ARCH>;
     using compile_ret_t = std::tuple<continuation_e>;
     using compile_func = compile_ret_t (this_class::*)(virt_addr_t &pc, code_word_t instr, tu_builder&);
@@ -90,6 +128,8 @@ protected:
 
     compile_ret_t gen_single_inst_behavior(virt_addr_t &, unsigned int &, tu_builder&) override;
 
+    bool follow_branch(uint64_t cur_pc, code_word_t insn, virt_addr_t &pc, tu_builder& tu);
+
     void gen_trap_behavior(tu_builder& tu) override;
 
     void gen_raise_trap(tu_builder& tu, uint16_t trap_id, uint16_t cause);
@@ -98,15 +138,36 @@ protected:
 
     void gen_wait(tu_builder& tu, unsigned type);
 
+    // address of the instruction being translated, it is only materialized when a trap is taken
+    uint64_t inst_pc = 0;
+
+    // set if the instruction being translated may raise a trap, only then it needs a trap check
+    bool may_trap = false;
+
     inline void gen_trap_check(tu_builder& tu) {
-        tu("if(*trap_state!=0) goto trap_entry;");
+        // TRAP_STATE can only have changed if the instruction accessed memory, raised or left a trap or synced
+        if (may_trap || (super::sync_exec & (iss::PRE_SYNC | iss::POST_SYNC)) != 0)
+            tu("if(*trap_state!=0) {{ *pc = {:#x}; goto trap_entry; }}", inst_pc);
     }
 
+    // line of the last constant store to NEXT_PC, it is dead if the next one follows without being observed
+    size_t next_pc_line = std::numeric_limits<size_t>::max();
+
+    // set by the emitters of code which may read NEXT_PC before the next constant store to it
+    bool next_pc_observed = false;
+
     inline void gen_set_pc(tu_builder& tu, virt_addr_t pc, unsigned reg_num) {
         switch(reg_num){
-        case traits<ARCH>::NEXT_PC:
+        case traits<ARCH>::NEXT_PC: {
+            // the instruction's memory accesses and the sync callbacks call into the hart (and the debugger) which
+            // may read NEXT_PC. A taken trap need not be considered as enter_trap sets NEXT_PC before it is read
+            auto synced = (super::sync_exec & (iss::PRE_SYNC | iss::POST_SYNC)) != 0;
+            if (next_pc_line < tu.lines.size() && !next_pc_observed && !may_trap && !synced)
+                tu.lines[next_pc_line].clear();
+            next_pc_line = tu.lines.size();
+            next_pc_observed = synced; // by the POST_SYNC callback of the instruction
             tu("*next_pc = {:#x};", pc.val);
-            break;
+        } break;
         case traits<ARCH>::PC:
             tu("*pc = {:#x};", pc.val);
             break;
@@ -125,10 +186,11 @@ protected:
     enum { EXTR_MASK16 = MASK16 >> 2, EXTR_MASK32 = MASK32 >> 2 };
     enum { LUT_SIZE = 1 << util::bit_count(EXTR_MASK32), LUT_SIZE_C = 1 << util::bit_count(EXTR_MASK16) };
 
-    std::array<compile_func, LUT_SIZE> lut;
-
-    std::array<compile_func, LUT_SIZE_C> lut_00, lut_01, lut_10;
-    std::array<compile_func, LUT_SIZE> lut_11;
+    // the decoding tables only depend on the core type, they are built once and shared by all instances
+    struct decoding_luts {
+        std::array<compile_func, LUT_SIZE_C> lut_00, lut_01, lut_10;
+        std::array<compile_func, LUT_SIZE> lut_11;
+    };
 
     std::array<compile_func *, 4> qlut;
 
@@ -696,6 +758,7 @@ private:
     
     /* instruction 9: LB */
     compile_ret_t __lb(virt_addr_t& pc, code_word_t instr, tu_builder& tu){
+        may_trap = true; // the memory accesses call into the hart
         tu("LB_{:#010x}:", pc.val);
         vm_base<ARCH>::gen_sync(tu, PRE_SYNC, 9);
         uint8_t rd = ((bit_sub<7,5>(instr)));
@@ -731,6 +794,7 @@ private:
     
     /* instruction 10: LH */
     compile_ret_t __lh(virt_addr_t& pc, code_word_t instr, tu_builder& tu){
+        may_trap = true; // the memory accesses call into the hart
         tu("LH_{:#010x}:", pc.val);
         vm_base<ARCH>::gen_sync(tu, PRE_SYNC, 10);
         uint8_t rd = ((bit_sub<7,5>(instr)));
@@ -766,6 +830,7 @@ private:
     
     /* instruction 11: LW */
     compile_ret_t __lw(virt_addr_t& pc, code_word_t instr, tu_builder& tu){
+        may_trap = true; // the memory accesses call into the hart
         tu("LW_{:#010x}:", pc.val);
         vm_base<ARCH>::gen_sync(tu, PRE_SYNC, 11);
         uint8_t rd = ((bit_sub<7,5>(instr)));
@@ -801,6 +866,7 @@ private:
     
     /* instruction 12: LBU */
     compile_ret_t __lbu(virt_addr_t& pc, code_word_t instr, tu_builder& tu){
+        may_trap = true; // the memory accesses call into the hart
         tu("LBU_{:#010x}:", pc.val);
         vm_base<ARCH>::gen_sync(tu, PRE_SYNC, 12);
         uint8_t rd = ((bit_sub<7,5>(instr)));
@@ -836,6 +902,7 @@ private:
     
     /* instruction 13: LHU */
     compile_ret_t __lhu(virt_addr_t& pc, code_word_t instr, tu_builder& tu){
+        may_trap = true; // the memory accesses call into the hart
         tu("LHU_{:#010x}:", pc.val);
         vm_base<ARCH>::gen_sync(tu, PRE_SYNC, 13);
         uint8_t rd = ((bit_sub<7,5>(instr)));
@@ -871,6 +938,7 @@ private:
     
     /* instruction 14: SB */
     compile_ret_t __sb(virt_addr_t& pc, code_word_t instr, tu_builder& tu){
+        may_trap = true; // the memory accesses call into the hart
         tu("SB_{:#010x}:", pc.val);
         vm_base<ARCH>::gen_sync(tu, PRE_SYNC, 14);
         int16_t imm = signextend<int16_t,12>((bit_sub<7,5>(instr)) | (bit_sub<25,7>(instr) << 5));
@@ -904,6 +972,7 @@ private:
     
     /* instruction 15: SH */
     compile_ret_t __sh(virt_addr_t& pc, code_word_t instr, tu_builder& tu){
+        may_trap = true; // the memory accesses call into the hart
         tu("SH_{:#010x}:", pc.val);
         vm_base<ARCH>::gen_sync(tu, PRE_SYNC, 15);
         int16_t imm = signextend<int16_t,12>((bit_sub<7,5>(instr)) | (bit_sub<25,7>(instr) << 5));
@@ -937,6 +1006,7 @@ private:
     
     /* instruction 16: SW */
     compile_ret_t __sw(virt_addr_t& pc, code_word_t instr, tu_builder& tu){
+        may_trap = true; // the memory accesses call into the hart
         tu("SW_{:#010x}:", pc.val);
         vm_base<ARCH>::gen_sync(tu, PRE_SYNC, 16);
         int16_t imm = signextend<int16_t,12>((bit_sub<7,5>(instr)) | (bit_sub<25,7>(instr) << 5));
@@ -1582,6 +1652,7 @@ private:
     
     /* instruction 36: FENCE */
     compile_ret_t __fence(virt_addr_t& pc, code_word_t instr, tu_builder& tu){
+        may_trap = true; // the memory accesses call into the hart
         tu("FENCE_{:#010x}:", pc.val);
         vm_base<ARCH>::gen_sync(tu, PRE_SYNC, 36);
         uint8_t rd = ((bit_sub<7,5>(instr)));
@@ -1612,6 +1683,7 @@ private:
     
     /* instruction 37: FENCE_I */
     compile_ret_t __fence_i(virt_addr_t& pc, code_word_t instr, tu_builder& tu){
+        may_trap = true; // the memory accesses call into the hart
         tu("FENCE_I_{:#010x}:", pc.val);
         vm_base<ARCH>::gen_sync(tu, PRE_SYNC, 37);
         uint8_t rd = ((bit_sub<7,5>(instr)));
@@ -1747,6 +1819,7 @@ private:
     
     /* instruction 44: SFENCE.VMA */
     compile_ret_t __sfence_vma(virt_addr_t& pc, code_word_t instr, tu_builder& tu){
+        may_trap = true; // the memory accesses call into the hart
         tu("SFENCE_VMA_{:#010x}:", pc.val);
         vm_base<ARCH>::gen_sync(tu, PRE_SYNC, 44);
         uint8_t rs1 = ((bit_sub<15,5>(instr)));
@@ -1775,6 +1848,7 @@ private:
     
     /* instruction 45: CSRRW */
     compile_ret_t __csrrw(virt_addr_t& pc, code_word_t instr, tu_builder& tu){
+        may_trap = true; // the memory accesses call into the hart
         tu("CSRRW_{:#010x}:", pc.val);
         vm_base<ARCH>::gen_sync(tu, PRE_SYNC, 45);
         uint8_t rd = ((bit_sub<7,5>(instr)));
@@ -1813,6 +1887,7 @@ private:
     
     /* instruction 46: CSRRS */
     compile_ret_t __csrrs(virt_addr_t& pc, code_word_t instr, tu_builder& tu){
+        may_trap = true; // the memory accesses call into the hart
         tu("CSRRS_{:#010x}:", pc.val);
         vm_base<ARCH>::gen_sync(tu, PRE_SYNC, 46);
         uint8_t rd = ((bit_sub<7,5>(instr)));
@@ -1850,6 +1925,7 @@ private:
     
     /* instruction 47: CSRRC */
     compile_ret_t __csrrc(virt_addr_t& pc, code_word_t instr, tu_builder& tu){
+        may_trap = true; // the memory accesses call into the hart
         tu("CSRRC_{:#010x}:", pc.val);
         vm_base<ARCH>::gen_sync(tu, PRE_SYNC, 47);
         uint8_t rd = ((bit_sub<7,5>(instr)));
@@ -1887,6 +1963,7 @@ private:
     
     /* instruction 48: CSRRWI */
     compile_ret_t __csrrwi(virt_addr_t& pc, code_word_t instr, tu_builder& tu){
+        may_trap = true; // the memory accesses call into the hart
         tu("CSRRWI_{:#010x}:", pc.val);
         vm_base<ARCH>::gen_sync(tu, PRE_SYNC, 48);
         uint8_t rd = ((bit_sub<7,5>(instr)));
@@ -1921,6 +1998,7 @@ private:
     
     /* instruction 49: CSRRSI */
     compile_ret_t __csrrsi(virt_addr_t& pc, code_word_t instr, tu_builder& tu){
+        may_trap = true; // the memory accesses call into the hart
         tu("CSRRSI_{:#010x}:", pc.val);
         vm_base<ARCH>::gen_sync(tu, PRE_SYNC, 49);
         uint8_t rd = ((bit_sub<7,5>(instr)));
@@ -1960,6 +2038,7 @@ private:
     
     /* instruction 50: CSRRCI */
     compile_ret_t __csrrci(virt_addr_t& pc, code_word_t instr, tu_builder& tu){
+        may_trap = true; // the memory accesses call into the hart
         tu("CSRRCI_{:#010x}:", pc.val);
         vm_base<ARCH>::gen_sync(tu, PRE_SYNC, 50);
         uint8_t rd = ((bit_sub<7,5>(instr)));
@@ -2066,6 +2145,7 @@ private:
     
     /* instruction 53: C.LW */
     compile_ret_t __c_lw(virt_addr_t& pc, code_word_t instr, tu_builder& tu){
+        may_trap = true; // the memory accesses call into the hart
         tu("C_LW_{:#010x}:", pc.val);
         vm_base<ARCH>::gen_sync(tu, PRE_SYNC, 53);
         uint8_t rd = ((bit_sub<2,3>(instr)));
@@ -2097,6 +2177,7 @@ private:
     
     /* instruction 54: C.SW */
     compile_ret_t __c_sw(virt_addr_t& pc, code_word_t instr, tu_builder& tu){
+        may_trap = true; // the memory accesses call into the hart
         tu("C_SW_{:#010x}:", pc.val);
         vm_base<ARCH>::gen_sync(tu, PRE_SYNC, 54);
         uint8_t rs2 = ((bit_sub<2,3>(instr)));
@@ -2624,6 +2705,7 @@ private:
     
     /* instruction 72: C.LWSP */
     compile_ret_t __c_lwsp(virt_addr_t& pc, code_word_t instr, tu_builder& tu){
+        may_trap = true; // the memory accesses call into the hart
         tu("C_LWSP_{:#010x}:", pc.val);
         vm_base<ARCH>::gen_sync(tu, PRE_SYNC, 72);
         uint8_t uimm = ((bit_sub<2,2>(instr) << 6) | (bit_sub<4,3>(instr) << 2) | (bit_sub<12,1>(instr) << 5));
@@ -2773,6 +2855,7 @@ private:
     
     /* instruction 78: C.SWSP */
     compile_ret_t __c_swsp(virt_addr_t& pc, code_word_t instr, tu_builder& tu){
+        may_trap = true; // the memory accesses call into the hart
         tu("C_SWSP_{:#010x}:", pc.val);
         vm_base<ARCH>::gen_sync(tu, PRE_SYNC, 78);
         uint8_t rs2 = ((bit_sub<2,5>(instr)));
@@ -2842,14 +2925,24 @@ template <typename ARCH> vm_impl<ARCH>::vm_impl() { this(new ARCH()); }
 template <typename ARCH>
 vm_impl<ARCH>::vm_impl(ARCH &core, unsigned core_id, unsigned cluster_id)
 : vm_base<ARCH>(core, core_id, cluster_id) {
-    qlut[0] = lut_00.data();
-    qlut[1] = lut_01.data();
-    qlut[2] = lut_10.data();
-    qlut[3] = lut_11.data();
-    for (auto instr : instr_descr) {
-        auto quantrant = instr.value & 0x3;
-        expand_bit_mask(29, lutmasks[quantrant], instr.value >> 2, instr.mask >> 2, 0, qlut[quantrant], instr.op);
-    }
+    static decoding_luts luts;
+    static std::once_flag luts_built;
+    qlut[0] = luts.lut_00.data();
+    qlut[1] = luts.lut_01.data();
+    qlut[2] = luts.lut_10.data();
+    qlut[3] = luts.lut_11.data();
+    std::call_once(luts_built, [this]() {
+        for (auto instr : instr_descr) {
+            auto quantrant = instr.value & 0x3;
+            expand_bit_mask(29, lutmasks[quantrant], instr.value >> 2, instr.mask >> 2, 0, qlut[quantrant], instr.op);
+        }
+    });
+    code_tracker = dynamic_cast<iss::code_tracking_if *>(&core);
+    if (code_tracker != nullptr)
+        code_tracker->set_code_invalidation_handler([this](uint64_t start, uint64_t end) {
+            apply_debug_stepping();
+            invalidate_code(start, end);
+        });
 }
 
 template <typename ARCH>
@@ -2857,6 +2950,11 @@ std::tuple<continuation_e>
 vm_impl<ARCH>::gen_single_inst_behavior(virt_addr_t &pc, unsigned int &inst_cnt, tu_builder& tu) {
     // we fetch at max 4 byte, alignment is 2
     enum {TRAP_ID=1<<16};
+    auto start = std::chrono::steady_clock::now();
+    if (inst_cnt == 0) {
+        vm_stats.blocks_translated++;
+        next_pc_line = std::numeric_limits<size_t>::max();
+    }
     code_word_t insn = 0;
     const typename traits<ARCH>::addr_t upper_bits = ~traits<ARCH>::PGMASK;
     phys_addr_t paddr(pc);
@@ -2873,6 +2971,8 @@ vm_impl<ARCH>::gen_single_inst_behavior(virt_addr_t &pc, unsigned int &inst_cnt,
         if (res != iss::Ok) throw trap_access(TRAP_ID, pc.val);
     }
     if (insn == 0x0000006f || (insn&0xffff)==0xa001) throw simulation_stopped(0); // 'J 0' or 'C.J 0'
+    if (inst_cnt == 0) block_start = paddr.val;
+    page_blocks[paddr.val & upper_bits].insert(block_start);
     // curr pc on stack
     ++inst_cnt;
     auto lut_val = extract_fields(insn);
@@ -2880,15 +2980,105 @@ vm_impl<ARCH>::gen_single_inst_behavior(virt_addr_t &pc, unsigned int &inst_cnt,
     if (f == nullptr) {
         f = &this_class::illegal_intruction;
     }
-    return (this->*f)(pc, insn, tu);
+    inst_pc = pc.val;
+    may_trap = false;
+    // the PC is not updated per instruction, but the hart needs it for CSR accesses (SYSTEM instructions), e.g. to
+    // detect code polling the time
+    if ((insn & 0x7f) == 0x73) gen_set_pc(tu, pc, traits<ARCH>::PC);
+    // AMOs and LR/SC are serialized with other harts sharing the memory from the start of the instruction to their
+    // last memory access, an LR to x0 does not access memory
+    if ((insn & 0x7f) == 0x2f && ((insn >> 27) != 0x2 || (insn & 0xf80) != 0)) {
+        tu.open_scope();
+        tu.write_mem(traits<ARCH>::FENCE, tu.constant(4, 64U), tu.constant(0, 32U));
+        tu.close_scope();
+    }
+    auto sync_exec = super::sync_exec;
+    if (dbg_free_run && (inst_cnt == 1 || rv_tgt_adapter->has_break(paddr.val))) super::sync_exec = super::ALL_SYNC;
+    auto ret = (this->*f)(pc, insn, tu);
+    super::sync_exec = sync_exec;
+    // superblock formation: extend the block along direct jumps and forward conditional branches. The path is chosen
+    // statically as dbt-core translates a block on its first execution, there are no execution counts to guide it
+    if (std::get<0>(ret) == BRANCH && f != &this_class::illegal_intruction && follow_branch(inst_pc, insn, pc, tu))
+        ret = std::make_tuple(CONT);
+    if (std::get<0>(ret) != CONT) next_pc_line = std::numeric_limits<size_t>::max();
+    vm_stats.instructions_translated++;
+    vm_stats.translation_ns +=
+        std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+    return ret;
+}
+
+template <typename ARCH>
+bool vm_impl<ARCH>::follow_branch(uint64_t cur_pc, code_word_t insn, virt_addr_t &pc, tu_builder& tu) {
+    // only forward targets within the page are followed, this keeps the addresses of the instructions
+    // in a block ascending (and hence their labels unique) and the size of the block bounded
+    const typename traits<ARCH>::addr_t upper_bits = ~traits<ARCH>::PGMASK;
+    auto br = decode_direct_branch<traits<ARCH>::XLEN>(insn, cur_pc);
+    if (br.kind == direct_branch::NONE || br.target <= cur_pc || (br.target & upper_bits) != (cur_pc & upper_bits))
+        return false;
+    if (br.kind == direct_branch::JUMP)
+        pc.val = br.target;
+    else { // continue along the fall through path and leave the block if the branch is taken
+        tu("if(*next_pc != {:#x}) return *next_pc;", pc.val);
+        next_pc_observed = true;
+    }
+    // the followed branch must not appear as the last branch when the block ends further down
+    tu.store(tu.constant(std::numeric_limits<uint32_t>::max(), 32), traits<ARCH>::LAST_BRANCH);
+    return true;
+}
+
+template <typename ARCH> void vm_impl<ARCH>::set_debug_stepping(bool step) {
+    // called by the debugger thread while the simulation may be within a block, hence the switch is only recorded.
+    // The empty range just has the invalidation handler called at the next block boundary
+    if (dbg_step_requested.exchange(step) != step && code_tracker != nullptr)
+        code_tracker->request_code_invalidation(0, 0);
+}
+
+template <typename ARCH> void vm_impl<ARCH>::apply_debug_stepping() {
+    // single steps need a sync per instruction, hence the code is translated again when the mode changed. A step
+    // followed by a continue before the core reached a block boundary does not change it
+    bool step = dbg_step_requested;
+    if (dbg_free_run == !step) return;
+    dbg_free_run = !step;
+    if (step)
+        super::sync_exec = super::ALL_SYNC;
+    else
+        super::sync_exec = this->core.needed_sync();
+    invalidate_code(0, std::numeric_limits<uint64_t>::max());
+}
+
+template <typename ARCH> void vm_impl<ARCH>::invalidate_code(uint64_t start, uint64_t end) {
+    // the core calls this at a block boundary, hence none of the blocks is executing. Only the blocks built from
+    // the modified pages are dropped, they get translated again when executed next time
+    const typename traits<ARCH>::addr_t upper_bits = ~traits<ARCH>::PGMASK;
+    bool dropped = false;
+    auto drop_page = [this, &dropped](typename decltype(page_blocks)::iterator it) {
+        for (auto blk : it->second) dropped |= this->func_map.erase(blk) != 0;
+        return page_blocks.erase(it);
+    };
+    if ((end - (start & upper_bits)) / traits<ARCH>::PGSIZE > page_blocks.size()) { // e.g. a flush of all code
+        for (auto it = page_blocks.begin(); it != page_blocks.end();)
+            it = it->first < end && it->first + traits<ARCH>::PGSIZE > start ? drop_page(it) : std::next(it);
+    } else {
+        for (auto page = start & upper_bits; page < end; page += traits<ARCH>::PGSIZE) {
+            auto it = page_blocks.find(page);
+            if (it != page_blocks.end()) drop_page(it);
+        }
+    }
+    // the remaining blocks may be chained to the dropped ones, their successors are looked up again instead
+    if (dropped)
+        for (auto &entry : this->func_map)
+            std::fill(std::begin(entry.second.cont), std::end(entry.second.cont), nullptr);
 }
 
 template <typename ARCH> void vm_impl<ARCH>::gen_raise_trap(tu_builder& tu, uint16_t trap_id, uint16_t cause) {
+    may_trap = true;
     tu("  *trap_state = {:#x};", 0x80 << 24 | (cause << 16) | trap_id);
     tu.store(tu.constant(std::numeric_limits<uint32_t>::max(), 32),traits<ARCH>::LAST_BRANCH);
 }
 
 template <typename ARCH> void vm_impl<ARCH>::gen_leave_trap(tu_builder& tu, unsigned lvl) {
+    may_trap = true;
+    next_pc_observed = true;
     tu("leave_trap(core_ptr, {});", lvl);
     tu.store(tu.read_mem(traits<ARCH>::CSR, (lvl << 8) + 0x41, traits<ARCH>::XLEN),traits<ARCH>::NEXT_PC);
     tu.store(tu.constant(std::numeric_limits<uint32_t>::max(), 32),traits<ARCH>::LAST_BRANCH);